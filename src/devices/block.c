@@ -19,6 +19,9 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long request_cnt;     /* Number of driver requests. */
+    unsigned long long seek_cnt;        /* Sectors between requests. */
+    block_sector_t head;                /* Sector after the last request. */
   };
 
 /* List of all block devices. */
@@ -28,6 +31,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void note_request (struct block *, block_sector_t, size_t cnt);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -123,6 +127,37 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
   check_sector (block, sector);
   block->ops->read (block->aux, sector, buffer);
   block->read_cnt++;
+  note_request (block, sector, 1);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, in a single driver request if the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer)
+{
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multi != NULL)
+    {
+      block->ops->read_multi (block->aux, sector, cnt, buffer);
+      note_request (block, sector, cnt);
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        block->ops->read (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+        note_request (block, sector + i, 1);
+      }
+  block->read_cnt += cnt;
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -137,6 +172,51 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   ASSERT (block->type != BLOCK_FOREIGN);
   block->ops->write (block->aux, sector, buffer);
   block->write_cnt++;
+  note_request (block, sector, 1);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, in a
+   single driver request if the driver supports it.  Returns after
+   the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer)
+{
+  const uint8_t *p = buffer;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multi != NULL)
+    {
+      block->ops->write_multi (block->aux, sector, cnt, buffer);
+      note_request (block, sector, cnt);
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        block->ops->write (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+        note_request (block, sector + i, 1);
+      }
+  block->write_cnt += cnt;
+}
+
+/* Counts a driver request for the CNT sectors of BLOCK starting at
+   SECTOR, and the distance the disk head had to travel to it from
+   the end of the previous one. */
+static void
+note_request (struct block *block, block_sector_t sector, size_t cnt)
+{
+  block->request_cnt++;
+  block->seek_cnt += sector > block->head ? sector - block->head
+                                          : block->head - sector;
+  block->head = sector + cnt;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -171,9 +251,11 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, %llu requests, "
+                  "%llu sectors seeked\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->request_cnt,
+                  block->seek_cnt);
         }
     }
 }
@@ -200,6 +282,9 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->request_cnt = 0;
+  block->seek_cnt = 0;
+  block->head = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
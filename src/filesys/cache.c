@@ -1,22 +1,78 @@
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "lib/debug.h"
 #include "lib/string.h"
 #include "threads/thread.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "devices/timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <round.h>
 #include "cache.h"
 
+/* Sectors that share one page of cache data */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
 #define ENABLE_BUFFER_CACHE
 
 #ifdef ENABLE_BUFFER_CACHE
   #define ENABLE_READ_AHEAD 
   #define ENABLE_PERIODIC_FLUSH 
+  #define ENABLE_CONCURRENT_MISS
+  #define ENABLE_HEAT_STATS
 #endif
 
+/* Locking rules: cache_lock protects the sector index and the
+   sector field of every entry, elock protects the content of a
+   single entry. A thread holding cache_lock may only try-acquire an
+   elock, never block on it: elock is held across disk I/O, cache_lock
+   never is (unless ENABLE_CONCURRENT_MISS is disabled, which
+   serializes all misses again for comparison). */
+
 static void bc_flush (struct buffer_cache_entry *entry);
+static bool bc_entry_busy (struct buffer_cache_entry *entry);
+static void bc_lock_entry (struct buffer_cache_entry *entry);
+static void bc_note_access (struct buffer_cache_entry *entry);
+static void bc_stat_add (unsigned long long *counter, unsigned long long n);
+static void bc_stat_wait (int64_t start);
+static void bc_read_begin (struct buffer_cache_entry *entry);
+static void bc_read_end (struct buffer_cache_entry *entry);
+static void bc_write_begin (struct buffer_cache_entry *entry);
+static void bc_write_end (struct buffer_cache_entry *entry);
+static void bc_mark_dirty (struct buffer_cache_entry *entry);
+static void bc_mark_clean (struct buffer_cache_entry *entry);
+#ifdef ENABLE_BUFFER_CACHE
+static void bc_zero_resident (block_sector_t sector);
+#endif
+static void bc_flush_dirty (bool all);
+static bool bc_read_resident (block_sector_t sector, void *buffer);
+static size_t bc_fill (block_sector_t sector, size_t cnt, void *buffer,
+                       bool prefetch);
 bool bc_get_and_lock_entry (struct buffer_cache_entry **ref_entry, block_sector_t sector);
+static struct buffer_cache_entry * bc_claim_entry (block_sector_t sector);
+static void bc_install (struct buffer_cache_entry *entry, block_sector_t sector);
+static void bc_stat_heat (block_sector_t sector);
 static struct buffer_cache_entry * bc_get_entry_by_sector (block_sector_t sector);
 static struct buffer_cache_entry * bc_get_free_entry (void);
+static void bc_allocate (void);
+static struct buffer_cache_entry * bc_clock_victim (void);
+static struct buffer_cache_entry * bc_2q_victim (void);
+static struct buffer_cache_entry * bc_2q_queue_victim (struct list *queue);
+static void bc_policy_touch (struct buffer_cache_entry *entry);
+static void bc_policy_replace (struct buffer_cache_entry *entry, block_sector_t sector);
+static void bc_policy_forget (struct buffer_cache_entry *entry);
+static void bc_queue_move (struct buffer_cache_entry *entry, enum bc_queue queue);
+static void bc_ghost_add (block_sector_t sector);
+static bool bc_ghost_take (block_sector_t sector);
+static unsigned bc_ghost_hash (const struct hash_elem *he, void *aux UNUSED);
+static bool bc_ghost_less (const struct hash_elem *ha, const struct hash_elem *hb,
+                           void *aux UNUSED);
+static unsigned bc_sector_hash (const struct hash_elem *he, void *aux UNUSED);
+static bool bc_sector_less (const struct hash_elem *ha, const struct hash_elem *hb,
+                            void *aux UNUSED);
 
 #ifdef ENABLE_PERIODIC_FLUSH
 static void bc_daemon_flush(void *aux);
@@ -26,31 +82,221 @@ static void bc_daemon_flush(void *aux);
 static void bc_daemon_read_ahead(void *aux);
 #endif
 
-struct buffer_cache_entry cache [MAX_CACHE_SECTORS];
+struct buffer_cache_entry *cache;     /* Allocated at boot from the kernel pool */
+size_t cache_size = DEFAULT_CACHE_SECTORS;
 struct lock cache_lock;
-block_sector_t read_ahead [MAX_READ_AHEAD];
+struct hash cache_index;              /* Sector -> entry, protected by cache_lock */
+enum bc_policy cache_policy = BC_DEFAULT_POLICY;
+struct cache_stats stats;             /* Updated through bc_stat_add() */
+
+/* Write-back state. Dirty entries are kept on dirty_list in the
+   order they were first written, so the flusher only visits dirty
+   entries and finds the oldest ones at the front. An entry is on the
+   list exactly when is_dirty is set; both change under its elock and
+   dirty_lock, which is never held while blocking on anything else. */
+struct list dirty_list;
+size_t dirty_cnt;
+struct lock dirty_lock;
+struct lock flush_lock;               /* One flusher at a time */
+uint8_t *flush_buffer;                /* BC_FLUSH_BATCH sectors, under flush_lock */
+int dirty_ratio = DEFAULT_DIRTY_RATIO;
+int dirty_age_ms = DEFAULT_DIRTY_AGE_MS;
+
+/* 2Q state, protected by cache_lock. New sectors enter a1in and are
+   evicted from it in FIFO order, leaving their number in the ghost
+   list a1out; a miss on a ghost sector means it is really reused, so
+   it goes to the am LRU list. A single sequential scan thus only
+   ever cycles through a1in and cannot flush the hot am entries. */
+struct bc_ghost
+{
+  block_sector_t sector;              /* Sector recently evicted from a1in */
+  struct list_elem elem;              /* Element in a1out or ghost_free */
+  struct hash_elem hash_elem;         /* Element in ghost_index */
+};
+
+struct list queue_free;               /* Entries without a sector */
+struct list queue_a1in;               /* Front is the newest */
+struct list queue_am;                 /* Front is the most recently used */
+struct list queue_pinned;             /* Entries with pins, never scanned */
+size_t pinned_cnt;
+size_t pinned_max;                    /* Pinned entries allowed at once */
+size_t a1in_cnt;
+size_t a1in_max;                      /* Kin: a1in may grow up to this */
+struct list a1out;                    /* Ghosts, front is the newest */
+struct list ghost_free;               /* Unused ghosts */
+struct hash ghost_index;              /* Sector -> ghost in a1out */
+
+/* One read-ahead request: the sectors behind a window of a file,
+   fetched by the read-ahead daemon in a single pass. */
+struct bc_ra_request
+{
+  block_sector_t sectors[RA_MAX_WINDOW];
+  size_t cnt;
+};
+
+struct bc_ra_request ra_queue[RA_QUEUE_LEN]; /* Ring of pending requests */
+size_t ra_head;
+size_t ra_cnt;
+struct lock ra_lock;                  /* Protects ra_queue */
 bool daemon_started;
-struct semaphore rh_sema;
+struct semaphore rh_sema;             /* Counts pending requests */
+
+/* Sets the number of cache entries, must be called before bc_init.
+   The size is rounded up to a whole number of pages and clamped to
+   [MIN_CACHE_SECTORS, MAX_CACHE_SECTORS]. */
+void bc_configure (size_t sectors)
+{
+  if (sectors < MIN_CACHE_SECTORS)
+    sectors = MIN_CACHE_SECTORS;
+  if (sectors > MAX_CACHE_SECTORS)
+    sectors = MAX_CACHE_SECTORS;
+  cache_size = ROUND_UP (sectors, SECTORS_PER_PAGE);
+}
+
+/* Picks the replacement policy by NAME ("clock" or "2q"), must be
+   called before bc_init. Returns false if NAME is unknown. */
+bool bc_configure_policy (const char *name)
+{
+  if (name != NULL && !strcmp (name, "clock"))
+    cache_policy = BC_POLICY_CLOCK;
+  else if (name != NULL && !strcmp (name, "2q"))
+    cache_policy = BC_POLICY_2Q;
+  else
+    return false;
+  return true;
+}
+
+/* Sets when the flush daemon writes dirty entries back: as soon as
+   more than DIRTY_RATIO percent of the cache is dirty, and in any case
+   once an entry has been dirty for DIRTY_AGE_MS milliseconds. Must be
+   called before bc_start_daemon. */
+void bc_configure_writeback (int ratio, int age_ms)
+{
+  if (ratio >= 0)
+    dirty_ratio = ratio < 100 ? ratio : 100;
+  if (age_ms >= 0)
+    dirty_age_ms = age_ms;
+}
 
 void bc_init ()
 {
 #ifdef ENABLE_BUFFER_CACHE
-  for (int i = 0; i < MAX_CACHE_SECTORS; i++)
+  list_init (&queue_free);
+  list_init (&queue_a1in);
+  list_init (&queue_am);
+  list_init (&queue_pinned);
+  list_init (&a1out);
+  list_init (&ghost_free);
+  a1in_cnt = 0;
+  a1in_max = cache_size / 4;
+  pinned_cnt = 0;
+  hash_init (&ghost_index, bc_ghost_hash, bc_ghost_less, NULL);
+  list_init (&dirty_list);
+  dirty_cnt = 0;
+  lock_init (&dirty_lock);
+  lock_init (&flush_lock);
+  flush_buffer = malloc (BC_FLUSH_BATCH * BLOCK_SECTOR_SIZE);
+  if (flush_buffer == NULL)
+    PANIC ("Not enough memory for the buffer cache");
+
+  bc_allocate ();
+  pinned_max = cache_size * BC_PIN_PERCENT / 100;
+  for (size_t i = 0; i < cache_size; i++)
   {
     struct buffer_cache_entry *entry = &cache[i];
     entry->sector = EMPTY_SECTOR;
     entry->is_in_second_chance = false;
     entry->is_dirty = false;
+    entry->is_prefetched = false;
     entry->readers = 0;
+    entry->writers = 0;
+    entry->waiters = 0;
+    entry->pins = 0;
     lock_init (&cache[i].elock);
+    cond_init (&cache[i].rw_cond);
+    entry->queue = BC_QUEUE_FREE;
+    list_push_back (&queue_free, &entry->queue_elem);
   }
+  hash_init (&cache_index, bc_sector_hash, bc_sector_less, NULL);
 #endif
 
   lock_init(&cache_lock);
   sema_init(&rh_sema, 0);
+  lock_init (&ra_lock);
+  ra_head = ra_cnt = 0;
   daemon_started = false;
 }
 
+/* Allocates CACHE_SIZE entries from the kernel pool. CACHE_SIZE is
+   first cut down so that the entries, their data and the ghost list
+   take at most BC_MEMORY_PERCENT of the free pages, leaving the rest
+   to thread stacks, page tables and malloc(). The entry table needs
+   contiguous pages and is halved until it fits, the data is taken one
+   page at a time and the cache is cut down to the sectors that could
+   be backed. */
+static void bc_allocate ()
+{
+  size_t budget = palloc_free_cnt (0) * BC_MEMORY_PERCENT / 100 * PGSIZE;
+  size_t per_sector = BLOCK_SECTOR_SIZE + sizeof *cache;
+  size_t max_size;
+  size_t pages;
+
+  if (cache_policy == BC_POLICY_2Q)
+    per_sector += DIV_ROUND_UP (sizeof (struct bc_ghost), 2);
+  max_size = ROUND_DOWN (budget / per_sector, SECTORS_PER_PAGE);
+  if (cache_size > max_size)
+    {
+      printf ("buffer cache: %zu sectors do not fit in %d%% of memory\n",
+              cache_size, BC_MEMORY_PERCENT);
+      cache_size = max_size;
+    }
+
+  cache = NULL;
+  while (cache == NULL)
+    {
+      if (cache_size < MIN_CACHE_SECTORS)
+        PANIC ("Not enough memory for the buffer cache");
+      pages = DIV_ROUND_UP (cache_size * sizeof *cache, PGSIZE);
+      cache = palloc_get_multiple (PAL_ZERO, pages);
+      if (cache == NULL)
+        cache_size = ROUND_DOWN (cache_size / 2, SECTORS_PER_PAGE);
+    }
+
+  for (size_t i = 0; i < cache_size; i += SECTORS_PER_PAGE)
+    {
+      char *page = palloc_get_page (0);
+      if (page == NULL)
+        {
+          cache_size = i;
+          break;
+        }
+      for (size_t j = 0; j < SECTORS_PER_PAGE; j++)
+        cache[i + j].data = page + j * BLOCK_SECTOR_SIZE;
+    }
+
+  if (cache_size < MIN_CACHE_SECTORS)
+    PANIC ("Not enough memory for the buffer cache");
+
+  /* Ghosts remember up to half the cache size worth of sectors, fewer
+     if there are not enough contiguous pages for them */
+  if (cache_policy == BC_POLICY_2Q)
+    {
+      size_t ghost_cnt = cache_size / 2;
+      struct bc_ghost *ghosts = NULL;
+
+      for (; ghosts == NULL && ghost_cnt > 0; ghost_cnt /= 2)
+        {
+          pages = DIV_ROUND_UP (ghost_cnt * sizeof *ghosts, PGSIZE);
+          ghosts = palloc_get_multiple (0, pages);
+          if (ghosts != NULL)
+            for (size_t i = 0; i < ghost_cnt; i++)
+              list_push_back (&ghost_free, &ghosts[i].elem);
+        }
+    }
+
+  printf ("buffer cache: %zu sectors\n", cache_size);
+}
+
 void bc_start_daemon ()
 {
   ASSERT (!daemon_started);
@@ -76,20 +322,22 @@ void bc_block_read (block_sector_t sector, void *buffer, off_t offset, off_t siz
   struct buffer_cache_entry *cache_entry = NULL;
   bool is_cache_miss = bc_get_and_lock_entry (&cache_entry, sector); //acquires elock
 
-  lock_acquire (&cache_lock); 
+#ifndef ENABLE_CONCURRENT_MISS
+  lock_acquire (&cache_lock);
+#endif
   if(is_cache_miss)
       block_read (fs_device, sector, cache_entry->data);
+#ifndef ENABLE_CONCURRENT_MISS
   lock_release (&cache_lock);
+#endif
 
   cache_entry->is_in_second_chance = false;
-  cache_entry->readers ++;
-  lock_release(&cache_entry->elock);
+  bc_note_access (cache_entry);
+  bc_read_begin (cache_entry); //releases elock
   
   memcpy (buffer, cache_entry->data + offset, size);
 
-  lock_acquire(&cache_entry->elock);
-  cache_entry->readers --; //entry will not be evicted, readers > 0
-  lock_release(&cache_entry->elock);
+  bc_read_end (cache_entry);
 #else
   lock_acquire(&cache_lock);
   uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
@@ -103,65 +351,320 @@ void bc_block_read (block_sector_t sector, void *buffer, off_t offset, off_t siz
 #endif
 }
 
+/* Reads the CNT whole sectors starting at SECTOR into BUFFER, which
+   must have room for CNT * BLOCK_SECTOR_SIZE bytes. Resident sectors
+   are copied out of the cache, each run of missing ones is read with
+   a single disk request and brought into the cache as well. */
+void bc_block_read_multi (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t n = 0;
+
+#ifdef ENABLE_BUFFER_CACHE
+      if (bc_read_resident (sector, buffer))
+        n = 1;
+      else if (cnt > 1)
+        n = bc_fill (sector, cnt, buffer, false);
+#endif
+      if (n == 0)
+        {
+          bc_block_read (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+          n = 1;
+        }
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Reads the CNT whole sectors starting at SECTOR into BUFFER without
+   making room for them in the cache, for callers that keep their own
+   copy of the data such as page faults on mapped files. Resident
+   entries are used since they may be newer than the disk; the other
+   sectors go straight from the disk into BUFFER, a run of them at a
+   time. BUFFER must be kernel memory. */
+void bc_block_read_bypass (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+#ifdef ENABLE_BUFFER_CACHE
+  size_t run = 0;                       /* Missing sectors before I */
+
+  for (size_t i = 0; i <= cnt; i++)
+    {
+      if (i < cnt
+          && !bc_read_resident (sector + i, buffer + i * BLOCK_SECTOR_SIZE))
+        {
+          run++;
+          continue;
+        }
+      if (run > 0)
+        {
+          bc_stat_add (&stats.bypassed, run);
+          block_read_multi (fs_device, sector + i - run, run,
+                            buffer + (i - run) * BLOCK_SECTOR_SIZE);
+          run = 0;
+        }
+    }
+#else
+  for (size_t i = 0; i < cnt; i++)
+    bc_block_read (sector + i, buffer + i * BLOCK_SECTOR_SIZE, 0,
+                   BLOCK_SECTOR_SIZE);
+#endif
+}
+
+#ifdef ENABLE_BUFFER_CACHE
+/* Copies SECTOR into BUFFER and returns true if it is resident,
+   otherwise returns false: the disk is then up to date. */
+static bool bc_read_resident (block_sector_t sector, void *buffer)
+{
+  struct buffer_cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = bc_get_entry_by_sector (sector);
+  if (e != NULL)
+    {
+      bc_stat_heat (sector);
+      bc_stat_add (&stats.hits, 1);
+      bc_policy_touch (e);
+    }
+  lock_release (&cache_lock);
+
+  if (e == NULL)
+    return false;
+
+  bc_lock_entry (e);
+  if (e->sector != sector) //double check for eviction
+    { /* Evicted meanwhile, so written back */
+      lock_release (&e->elock);
+      return false;
+    }
+  e->is_in_second_chance = false;
+  bc_note_access (e);
+  bc_read_begin (e); //releases elock
+  memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+  bc_read_end (e);
+  return true;
+}
+
+/* Brings up to CNT sectors starting at SECTOR into the cache with a
+   single disk request, stopping before the first one that is already
+   resident. Copies them to BUFFER as well unless it is a null
+   pointer, and marks them as read ahead if PREFETCH. Returns how many
+   sectors were read, 0 if SECTOR is resident or no entry is free.
+   All entries of the run are held while the disk works: they are
+   fresh, and claiming more only ever try-locks the others. */
+static size_t bc_fill (block_sector_t sector, size_t cnt, void *buffer,
+                       bool prefetch)
+{
+  struct buffer_cache_entry *run[BC_RUN_MAX];
+  uint8_t *bounce;
+  size_t n;
+
+  /* A single request must not take over the cache */
+  if (cnt > BC_RUN_MAX)
+    cnt = BC_RUN_MAX;
+  if (cnt > cache_size / 4)
+    cnt = cache_size / 4;
+
+  bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+  if (bounce == NULL)
+    return 0;
+
+  for (n = 0; n < cnt; n++)
+    if ((run[n] = bc_claim_entry (sector + n)) == NULL)
+      break;
+
+  if (n > 0)
+    {
+#ifndef ENABLE_CONCURRENT_MISS
+      lock_acquire (&cache_lock);
+#endif
+      block_read_multi (fs_device, sector, n, bounce);
+#ifndef ENABLE_CONCURRENT_MISS
+      lock_release (&cache_lock);
+#endif
+
+      for (size_t i = 0; i < n; i++)
+        {
+          memcpy (run[i]->data, bounce + i * BLOCK_SECTOR_SIZE,
+                  BLOCK_SECTOR_SIZE);
+          run[i]->is_in_second_chance = false;
+          run[i]->is_prefetched = prefetch;
+          lock_release (&run[i]->elock);
+        }
+
+      /* BUFFER may be user memory: copy without holding any elock */
+      if (buffer != NULL)
+        memcpy (buffer, bounce, n * BLOCK_SECTOR_SIZE);
+    }
+
+  free (bounce);
+  return n;
+}
+#endif
+
 /* Guarantees to find and return an entry allocated for the given sector.
-   Returns true in case of cache HIT, false otherwise. If the return is 
-   false, the data field will not be valid. Call with cache lock DISABLED
+   Returns true in case of cache MISS, false otherwise. If the return is 
+   true, the data field will not be valid and the caller must fill it
+   before releasing elock. Call with cache lock DISABLED.
+   A thread that hits an entry which is still being filled sleeps on
+   its elock without holding cache_lock, so the rest of the cache stays
+   available while the disk works.
 */
 bool bc_get_and_lock_entry (struct buffer_cache_entry **ref_entry, block_sector_t sector)
 {
-  bool found = false;
-  bool is_cache_miss;
   struct buffer_cache_entry *e;
 
-  do
+  bc_stat_heat (sector);
+
+  while (true)
   {
     lock_acquire (&cache_lock);
     e = bc_get_entry_by_sector(sector);
 
-    if (e == NULL)
-      { /* CACHE MISS */
-        is_cache_miss = true;
-        e = bc_get_free_entry (); //will acquire elock
-        e->sector = sector;
-        e->is_dirty = false;
-      }
-    else
+    if (e != NULL)
       { /* CACHE HIT */
-        is_cache_miss = false;
-        lock_acquire (&e->elock);
+        bc_stat_add (&stats.hits, 1);
+        bc_policy_touch (e);
+        lock_release (&cache_lock);
+        bc_lock_entry (e);
+
+        if (e->sector == sector) //double check for eviction
+          break;
+
+        lock_release (&e->elock);
+        continue;
       }
-    
-    ASSERT (lock_held_by_current_thread(&e->elock));
 
-    found = sector == e->sector;
+    /* CACHE MISS */
+    e = bc_get_free_entry (); //tries to acquire elock
+    if (e == NULL)
+      { /* Every entry is busy: let the holders make progress */
+        lock_release (&cache_lock);
+        thread_yield ();
+        continue;
+      }
 
-    if (!found)
-      lock_release (&e->elock);
+    if (e->sector != EMPTY_SECTOR && e->is_dirty)
+      { /* Write back the victim outside of cache_lock, then look again:
+           the entry stays indexed under its old sector until it is clean */
+        lock_release (&cache_lock);
+        bc_flush (e);
+        lock_release (&e->elock);
+        continue;
+      }
 
+    bc_install (e, sector);
     lock_release (&cache_lock);
 
-  } while (!found);
+    *ref_entry = e;
+    return true;
+  }
 
   ASSERT (e != NULL);
   ASSERT (e->sector == sector);
   ASSERT (lock_held_by_current_thread(&e->elock));
 
   *ref_entry = e;
-  return is_cache_miss;
+  return false;
 }
 
-void bc_request_read_ahead (block_sector_t sector UNUSED /*when RH disabled*/)
+/* Like a miss in bc_get_and_lock_entry(), but never waits for
+   another entry: returns NULL if SECTOR is resident or every entry
+   is busy. Otherwise the returned entry is locked and its data is
+   not valid yet. Call with cache lock DISABLED. */
+static struct buffer_cache_entry * bc_claim_entry (block_sector_t sector)
+{
+  struct buffer_cache_entry *e;
+
+  while (true)
+    {
+      lock_acquire (&cache_lock);
+      if (bc_get_entry_by_sector (sector) != NULL)
+        {
+          lock_release (&cache_lock);
+          return NULL;
+        }
+
+      e = bc_get_free_entry (); //tries to acquire elock
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          return NULL;
+        }
+
+      if (e->sector != EMPTY_SECTOR && e->is_dirty)
+        {
+          lock_release (&cache_lock);
+          bc_flush (e);
+          lock_release (&e->elock);
+          continue;
+        }
+
+      bc_stat_heat (sector);
+      bc_install (e, sector);
+      lock_release (&cache_lock);
+      return e;
+    }
+}
+
+/* Makes ENTRY, a clean victim locked by the current thread, hold
+   SECTOR. Call with cache lock ENABLED. */
+static void bc_install (struct buffer_cache_entry *e, block_sector_t sector)
+{
+  if (e->sector != EMPTY_SECTOR)
+    {
+      hash_delete (&cache_index, &e->hash_elem);
+      bc_stat_add (&stats.evictions, 1);
+      if (e->is_prefetched)
+        bc_stat_add (&stats.ra_wasted, 1);
+    }
+  bc_policy_replace (e, sector);
+  ASSERT (!e->is_dirty);
+  e->sector = sector;
+  e->is_prefetched = false;
+  hash_insert (&cache_index, &e->hash_elem);
+  bc_stat_add (&stats.misses, 1);
+}
+
+/* Queues CNT sectors to be brought into the cache by the read-ahead
+   daemon. Read-ahead is only a hint: the request is dropped if the
+   queue is full or the daemon is not running yet. */
+void bc_request_read_ahead (const block_sector_t *sectors UNUSED, size_t cnt UNUSED)
 {
 #ifdef ENABLE_READ_AHEAD
-  for (int i = 0; i < MAX_READ_AHEAD; i++)
+  ASSERT (cnt <= RA_MAX_WINDOW);
+
+  if (!daemon_started || cnt == 0)
+    return;
+
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_LEN)
     {
-      if (read_ahead[i] != EMPTY_SECTOR)
-      {
-        read_ahead[i] = sector;
-        sema_up (&rh_sema);
-        return;
-      }
+      struct bc_ra_request *r = &ra_queue[(ra_head + ra_cnt) % RA_QUEUE_LEN];
+      memcpy (r->sectors, sectors, cnt * sizeof *sectors);
+      r->cnt = cnt;
+      ra_cnt++;
+      sema_up (&rh_sema);
     }
+  lock_release (&ra_lock);
+#endif
+}
+
+/* Returns the largest useful read-ahead window, in sectors. Prefetched
+   sectors enter the cache as referenced once, so a window larger than
+   the share of the cache kept for those would evict itself before
+   being read. */
+size_t bc_read_ahead_limit (void)
+{
+#ifdef ENABLE_READ_AHEAD
+  size_t limit = cache_size / 4;
+  return limit < RA_MAX_WINDOW ? limit : RA_MAX_WINDOW;
+#else
+  return 0;
 #endif
 }
 
@@ -171,33 +674,25 @@ void bc_block_write (block_sector_t sector, void *buffer, off_t offset, off_t si
   ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
 
   struct buffer_cache_entry *cache_entry = NULL;
-  bool is_allowed;
-  bool is_cache_miss;
+  bool is_cache_miss = bc_get_and_lock_entry (&cache_entry, sector); //acquires elock
 
-  while (!is_allowed)
+  if(is_cache_miss)
   {
-    is_cache_miss = bc_get_and_lock_entry (&cache_entry, sector); //acquires elock
-
-    if(is_cache_miss)
-    {
-      if (offset > 0 || 
-          size + offset < BLOCK_SECTOR_SIZE) 
-          block_read (fs_device, sector, cache_entry->data);
-        else
-          memset (cache_entry->data, 0, BLOCK_SECTOR_SIZE);
-    }
-
-    is_allowed = cache_entry->readers == 0;
-
-    if (!is_allowed)
-      lock_release(&cache_entry->elock);
+    if (offset > 0 || 
+        size + offset < BLOCK_SECTOR_SIZE) 
+        block_read (fs_device, sector, cache_entry->data);
+      else
+        memset (cache_entry->data, 0, BLOCK_SECTOR_SIZE);
   }
 
+  bc_write_begin (cache_entry); //sleeps until the readers are gone
+
   cache_entry->is_in_second_chance = false;
-  cache_entry->is_dirty = true;
+  bc_note_access (cache_entry);
+  bc_mark_dirty (cache_entry);
   memcpy (cache_entry->data + offset, buffer, size);
 
-  lock_release(&cache_entry->elock);
+  bc_write_end (cache_entry); //releases elock
 #else
   lock_acquire(&cache_lock);
   uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
@@ -216,53 +711,95 @@ void bc_block_write (block_sector_t sector, void *buffer, off_t offset, off_t si
 #endif
 }
 
-void bc_flush_all (void)
+/* Writes zeros over the CNT sectors starting at SECTOR, a run of up
+   to BC_RUN_MAX of them per device request, without caching them.
+   For sectors just taken from the free map. free_map_release() drops
+   sectors from the cache, but a read-ahead queued before that may
+   have brought one back with its old contents: the copies found
+   resident once the zeros are on disk are zeroed too. */
+void bc_block_zero (block_sector_t sector, size_t cnt)
 {
+  size_t run = cnt < BC_RUN_MAX ? cnt : BC_RUN_MAX;
+  uint8_t *zeros = calloc (run, BLOCK_SECTOR_SIZE);
+  if (zeros == NULL)
+    PANIC ("Malloc failed!");
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < run ? cnt : run;
+      block_write_multi (fs_device, sector, n, zeros);
 #ifdef ENABLE_BUFFER_CACHE
-  lock_acquire(&cache_lock);
-  int count = 0;
-  for (int i = 0; i < MAX_CACHE_SECTORS; i++)
+      for (size_t i = 0; i < n; i++)
+        bc_zero_resident (sector + i);
+#endif
+      sector += n;
+      cnt -= n;
+    }
+  free (zeros);
+}
+
+#ifdef ENABLE_BUFFER_CACHE
+/* Zeroes the cached copy of SECTOR, if there is one, to match the
+   zeros just written to disk. A read of the sector still in flight
+   holds the entry's elock, so its old data is overwritten once it
+   has landed; a read started later finds the zeros on disk. */
+static void bc_zero_resident (block_sector_t sector)
+{
+  struct buffer_cache_entry *entry;
+
+  lock_acquire (&cache_lock);
+  entry = bc_get_entry_by_sector (sector);
+  lock_release (&cache_lock);
+  if (entry == NULL)
+    return;
+
+  lock_acquire (&entry->elock);
+  if (entry->sector != sector) //evicted meanwhile
     {
-      struct buffer_cache_entry *entry = &cache[i];
-      lock_acquire (&entry->elock);
-      count ++;
-      if (entry->sector != EMPTY_SECTOR && entry->is_dirty)
-        {
-          bc_flush(entry);
-        }
       lock_release (&entry->elock);
+      return;
     }
-  lock_release(&cache_lock);
+  bc_write_begin (entry);
+  memset (entry->data, 0, BLOCK_SECTOR_SIZE);
+  bc_mark_clean (entry);
+  bc_write_end (entry); //releases elock
+}
+#endif
+
+void bc_flush_all (void)
+{
+#ifdef ENABLE_BUFFER_CACHE
+  bc_flush_dirty (true);
 #endif
 }
 
 /* Get a fresh entry to use, either via allocating or 
    eviction. Call with cache lock ENABLED.
-   The returned entry will be locked by the current thread */
+   The returned entry will be locked by the current thread and may
+   still be dirty. Returns NULL if every entry is busy. */
 static struct buffer_cache_entry * bc_get_free_entry ()
+{
+  if (cache_policy == BC_POLICY_2Q)
+    return bc_2q_victim ();
+  else
+    return bc_clock_victim ();
+}
+
+/* Second chance sweep over the whole table. Gives up after
+   BC_EVICTION_ROUNDS rounds. */
+static struct buffer_cache_entry * bc_clock_victim ()
 {
   struct buffer_cache_entry *victim = NULL;
   int round = 0;
-  for (int i = 0; i < MAX_CACHE_SECTORS;)
+  for (size_t i = 0; i < cache_size && round < BC_EVICTION_ROUNDS;)
   {
-    bool allow_halt = round > 5;
-
     struct buffer_cache_entry *entry = &cache[i];
 
-    bool taken;
-    if(allow_halt)
+    /* Entries held by the current thread are part of a run being filled */
+    if (!lock_held_by_current_thread (&entry->elock)
+        && lock_try_acquire (&entry->elock))
     {
-      lock_acquire (&entry->elock);
-      taken = true;
-    }
-    else
-      taken = lock_try_acquire (&entry->elock);
-
-    if(taken)
-    {
-      bool readers_present = entry->readers > 0;
-
-      if (!readers_present)
+      if (!bc_entry_busy (entry))
       {
         if(entry->sector == EMPTY_SECTOR || 
            entry->is_in_second_chance)
@@ -277,65 +814,619 @@ static struct buffer_cache_entry * bc_get_free_entry ()
       lock_release (&entry->elock);
     }
 
-    if (i == MAX_CACHE_SECTORS - 1)
+    if (i == cache_size - 1)
     {
       i = 0;
       round ++;
-      //ASSERT (round < 3);
     }
     else
       i++;
   }
 
+  ASSERT (victim == NULL || lock_held_by_current_thread(&victim->elock));
 
-  ASSERT (victim != NULL);
-  ASSERT (lock_held_by_current_thread(&victim->elock))
-  
-  if(victim->sector != EMPTY_SECTOR && victim->is_dirty)
-    bc_flush (victim);
+  return victim;
+}
+
+/* 2Q victim: a free entry if any, otherwise the oldest a1in entry
+   while a1in is above Kin, otherwise the least recently used am
+   entry. Falls back to the other queue if every candidate is busy. */
+static struct buffer_cache_entry * bc_2q_victim ()
+{
+  struct buffer_cache_entry *victim;
+
+  victim = bc_2q_queue_victim (&queue_free);
+  if (victim == NULL && a1in_cnt > a1in_max)
+    victim = bc_2q_queue_victim (&queue_a1in);
+  if (victim == NULL)
+    victim = bc_2q_queue_victim (&queue_am);
+  if (victim == NULL)
+    victim = bc_2q_queue_victim (&queue_a1in);
 
   return victim;
 }
 
+/* Returns the oldest entry of QUEUE that can be evicted right now,
+   locked, or NULL. */
+static struct buffer_cache_entry * bc_2q_queue_victim (struct list *queue)
+{
+  struct list_elem *e;
+
+  for (e = list_rbegin (queue); e != list_rend (queue); e = list_prev (e))
+    {
+      struct buffer_cache_entry *entry = 
+      list_entry (e, struct buffer_cache_entry, queue_elem);
+
+      if (!lock_held_by_current_thread (&entry->elock)
+          && lock_try_acquire (&entry->elock))
+        {
+          if (!bc_entry_busy (entry))
+            return entry;
+          lock_release (&entry->elock);
+        }
+    }
+
+  return NULL;
+}
+
+/* Records a hit on ENTRY. Call with cache lock ENABLED. */
+static void bc_policy_touch (struct buffer_cache_entry *entry)
+{
+  /* Hits in a1in are correlated references: leave the entry alone */
+  if (cache_policy == BC_POLICY_2Q && entry->queue == BC_QUEUE_AM)
+    bc_queue_move (entry, BC_QUEUE_AM);
+}
+
+/* Moves ENTRY, which is about to hold SECTOR, to the right queue and
+   remembers the sector it is giving up. Call with cache lock ENABLED. */
+static void bc_policy_replace (struct buffer_cache_entry *entry, block_sector_t sector)
+{
+  if (cache_policy != BC_POLICY_2Q)
+    return;
+
+  if (entry->queue == BC_QUEUE_A1IN)
+    bc_ghost_add (entry->sector);
+
+  bc_queue_move (entry, bc_ghost_take (sector) ? BC_QUEUE_AM : BC_QUEUE_A1IN);
+}
+
+/* ENTRY does not hold a sector anymore. Call with cache lock ENABLED. */
+static void bc_policy_forget (struct buffer_cache_entry *entry)
+{
+  if (cache_policy == BC_POLICY_2Q)
+    bc_queue_move (entry, BC_QUEUE_FREE);
+}
+
+/* Puts ENTRY at the front of QUEUE */
+static void bc_queue_move (struct buffer_cache_entry *entry, enum bc_queue queue)
+{
+  static struct list * const queues[] = { &queue_free, &queue_a1in, &queue_am,
+                                          &queue_pinned };
+
+  list_remove (&entry->queue_elem);
+  if (entry->queue == BC_QUEUE_A1IN)
+    a1in_cnt --;
+
+  entry->queue = queue;
+  list_push_front (queues[queue], &entry->queue_elem);
+  if (queue == BC_QUEUE_A1IN)
+    a1in_cnt ++;
+}
+
+/* Remembers that SECTOR was just evicted from a1in, forgetting the
+   oldest ghost if there is no room left. */
+static void bc_ghost_add (block_sector_t sector)
+{
+  struct bc_ghost *ghost;
+
+  if (list_empty (&ghost_free) && list_empty (&a1out))
+    return;
+
+  if (!list_empty (&ghost_free))
+    ghost = list_entry (list_pop_front (&ghost_free), struct bc_ghost, elem);
+  else
+    {
+      ghost = list_entry (list_pop_back (&a1out), struct bc_ghost, elem);
+      hash_delete (&ghost_index, &ghost->hash_elem);
+    }
+
+  ghost->sector = sector;
+  if (hash_insert (&ghost_index, &ghost->hash_elem) != NULL)
+    list_push_front (&ghost_free, &ghost->elem); //already a ghost
+  else
+    list_push_front (&a1out, &ghost->elem);
+}
+
+/* Returns true, and forgets the ghost, if SECTOR was recently
+   evicted from a1in. */
+static bool bc_ghost_take (block_sector_t sector)
+{
+  struct bc_ghost key;
+  struct hash_elem *he;
+
+  key.sector = sector;
+  he = hash_delete (&ghost_index, &key.hash_elem);
+  if (he == NULL)
+    return false;
+
+  struct bc_ghost *ghost = hash_entry (he, struct bc_ghost, hash_elem);
+  list_remove (&ghost->elem);
+  list_push_front (&ghost_free, &ghost->elem);
+  return true;
+}
+
+/* Prints the hit ratio of the buffer cache. */
+void bc_print_stats (void)
+{
+  struct cache_stats st;
+  unsigned long long lookups;
+
+  bc_get_stats (&st);
+  lookups = st.hits + st.misses;
+
+  printf ("Buffer cache: %s policy, %llu hits, %llu misses",
+          cache_policy == BC_POLICY_2Q ? "2q" : "clock",
+          st.hits, st.misses);
+  if (lookups > 0)
+    printf (" (%llu%% hit ratio)", st.hits * 100 / lookups);
+  printf (", %llu bypassed\n", st.bypassed);
+  printf ("Buffer cache activity: %llu evictions, %llu flushes, "
+          "read-ahead %llu used %llu wasted, %llu waits (%llu ticks)\n",
+          st.evictions, st.flushes, st.ra_hits, st.ra_wasted,
+          st.lock_waits, st.lock_wait_ticks);
+#ifdef ENABLE_HEAT_STATS
+  printf ("Buffer cache heat:");
+  for (int i = 0; i < CACHE_HEAT_BUCKETS; i++)
+    printf (" %llu", st.heat[i]);
+  printf ("\n");
+#endif
+}
+
+/* Copies the counters into STATS. */
+void bc_get_stats (struct cache_stats *st)
+{
+  enum intr_level old_level = intr_disable ();
+  *st = stats;
+  intr_set_level (old_level);
+}
+
+/* Counters are bumped by threads holding unrelated locks, or none,
+   and are 64 bits wide: keep the update atomic. */
+static void bc_stat_add (unsigned long long *counter, unsigned long long n)
+{
+  enum intr_level old_level = intr_disable ();
+  *counter += n;
+  intr_set_level (old_level);
+}
+
+/* Counts a lookup of SECTOR in its slice of the device. */
+static void bc_stat_heat (block_sector_t sector UNUSED)
+{
+#ifdef ENABLE_HEAT_STATS
+  uint64_t bucket = (uint64_t) sector * CACHE_HEAT_BUCKETS / block_size (fs_device);
+  if (bucket < CACHE_HEAT_BUCKETS)
+    bc_stat_add (&stats.heat[bucket], 1);
+#endif
+}
+
+/* Accounts one wait on a busy entry that started at tick START. */
+static void bc_stat_wait (int64_t start)
+{
+  bc_stat_add (&stats.lock_waits, 1);
+  bc_stat_add (&stats.lock_wait_ticks, timer_elapsed (start));
+}
+
+/* Call with the elock of ENTRY held */
 static void bc_flush (struct buffer_cache_entry *entry)
 {
   block_write (fs_device, entry->sector, entry->data);
+  bc_stat_add (&stats.flushes, 1);
+  bc_mark_clean (entry);
+}
+
+//**** Shared/exclusive access to the data of an entry
+
+/* The elock of an entry is only held for short critical sections and
+   while the entry is filled from disk. Readers copy the data out
+   without it, registered in READERS; a writer holds elock for the
+   whole copy in, after waiting on RW_COND for the readers to leave.
+   A waiting writer stops new readers from coming in, so a stream of
+   readers cannot starve it. Entries with readers or waiters are never
+   evicted, so nobody has to look the sector up again after waking. */
+
+/* Call with the elock of ENTRY held */
+static bool bc_entry_busy (struct buffer_cache_entry *entry)
+{
+  return entry->readers > 0 || entry->waiters > 0 || entry->pins > 0;
+}
+
+/* Acquires the elock of ENTRY, accounting the wait if it is busy. */
+static void bc_lock_entry (struct buffer_cache_entry *entry)
+{
+  int64_t start;
+
+  if (lock_try_acquire (&entry->elock))
+    return;
+
+  start = timer_ticks ();
+  lock_acquire (&entry->elock);
+  bc_stat_wait (start);
+}
+
+/* Call with the elock of ENTRY held, on every read or write made on
+   behalf of the file system (not the read-ahead daemon). */
+static void bc_note_access (struct buffer_cache_entry *entry)
+{
+  if (entry->is_prefetched)
+    {
+      entry->is_prefetched = false;
+      bc_stat_add (&stats.ra_hits, 1);
+    }
+}
+
+/* Registers the current thread as a reader of ENTRY, whose elock must
+   be held, and releases elock. */
+static void bc_read_begin (struct buffer_cache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&entry->elock));
+
+  if (entry->writers > 0)
+    {
+      int64_t start = timer_ticks ();
+
+      while (entry->writers > 0)
+        {
+          entry->waiters++;
+          cond_wait (&entry->rw_cond, &entry->elock);
+          entry->waiters--;
+        }
+      bc_stat_wait (start);
+    }
+  entry->readers++;
+  lock_release (&entry->elock);
+}
+
+static void bc_read_end (struct buffer_cache_entry *entry)
+{
+  lock_acquire (&entry->elock);
+  ASSERT (entry->readers > 0);
+  entry->readers--;
+  if (entry->readers == 0 && entry->waiters > 0)
+    cond_broadcast (&entry->rw_cond, &entry->elock);
+  lock_release (&entry->elock);
+}
+
+/* Waits until ENTRY, whose elock must be held, has no readers. The
+   caller then has exclusive access until bc_write_end(). */
+static void bc_write_begin (struct buffer_cache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&entry->elock));
+
+  if (entry->readers > 0)
+    {
+      int64_t start = timer_ticks ();
+
+      entry->writers++;
+      while (entry->readers > 0)
+        {
+          entry->waiters++;
+          cond_wait (&entry->rw_cond, &entry->elock);
+          entry->waiters--;
+        }
+      entry->writers--;
+      bc_stat_wait (start);
+    }
+}
+
+/* Ends exclusive access to ENTRY and releases its elock. */
+static void bc_write_end (struct buffer_cache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&entry->elock));
+
+  if (entry->waiters > 0)
+    cond_broadcast (&entry->rw_cond, &entry->elock);
+  lock_release (&entry->elock);
+}
+
+/* Call with the elock of ENTRY held */
+static void bc_mark_dirty (struct buffer_cache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&entry->elock));
+
+  if (entry->is_dirty)
+    return;
+
+  lock_acquire (&dirty_lock);
+  entry->is_dirty = true;
+  entry->dirty_since = timer_ticks ();
+  list_push_back (&dirty_list, &entry->dirty_elem);
+  dirty_cnt++;
+  lock_release (&dirty_lock);
+}
+
+/* Call with the elock of ENTRY held */
+static void bc_mark_clean (struct buffer_cache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&entry->elock));
+
+  if (!entry->is_dirty)
+    return;
+
+  lock_acquire (&dirty_lock);
   entry->is_dirty = false;
+  list_remove (&entry->dirty_elem);
+  dirty_cnt--;
+  lock_release (&dirty_lock);
 }
 
+//**** Write-back
+
+/* A dirty entry picked by the flusher, with the sector it held when
+   it was picked. */
+struct bc_flush_slot
+{
+  struct buffer_cache_entry *entry;
+  block_sector_t sector;
+};
+
+static int
+bc_flush_slot_cmp (const void *a_, const void *b_)
+{
+  const struct bc_flush_slot *a = a_;
+  const struct bc_flush_slot *b = b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Fills BATCH with up to BC_FLUSH_BATCH dirty entries, oldest first,
+   and returns how many. Picks every dirty entry if ALL, otherwise
+   only those older than the age limit plus as many as it takes to
+   get back under the dirty ratio. */
+static size_t
+bc_collect_dirty (struct bc_flush_slot *batch, bool all)
+{
+  int64_t max_age = (int64_t) dirty_age_ms * TIMER_FREQ / 1000;
+  size_t max_dirty = cache_size * dirty_ratio / 100;
+  int64_t now = timer_ticks ();
+  size_t over, cnt = 0;
+  struct list_elem *e;
+
+  lock_acquire (&dirty_lock);
+  over = dirty_cnt > max_dirty ? dirty_cnt - max_dirty : 0;
+  for (e = list_begin (&dirty_list);
+       e != list_end (&dirty_list) && cnt < BC_FLUSH_BATCH;
+       e = list_next (e))
+    {
+      struct buffer_cache_entry *entry =
+        list_entry (e, struct buffer_cache_entry, dirty_elem);
+
+      if (!all && cnt >= over && now - entry->dirty_since < max_age)
+        break;
+
+      /* The sector of a dirty entry cannot change, the entry has to
+         be cleaned before it is reused or removed */
+      batch[cnt].entry = entry;
+      batch[cnt].sector = entry->sector;
+      cnt++;
+    }
+  lock_release (&dirty_lock);
+
+  return cnt;
+}
+
+/* Writes back RUN, CNT locked entries holding consecutive sectors in
+   ascending order, as a single disk request, and unlocks them. Call
+   with flush_lock held, it protects the staging buffer. */
+static void
+bc_write_run (struct buffer_cache_entry **run, size_t cnt)
+{
+  ASSERT (cnt <= BC_FLUSH_BATCH);
+
+  for (size_t i = 0; i < cnt; i++)
+    memcpy (flush_buffer + i * BLOCK_SECTOR_SIZE, run[i]->data,
+            BLOCK_SECTOR_SIZE);
+  block_write_multi (fs_device, run[0]->sector, cnt, flush_buffer);
+  bc_stat_add (&stats.flushes, cnt);
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      bc_mark_clean (run[i]);
+      lock_release (&run[i]->elock);
+    }
+}
+
+/* Writes BATCH back in elevator order: sorted by sector, with
+   neighbouring sectors grouped into runs. Entries that were cleaned
+   or reused since they were picked are skipped. */
+static void
+bc_flush_batch (struct bc_flush_slot *batch, size_t cnt)
+{
+  struct buffer_cache_entry *run[BC_FLUSH_BATCH];
+  size_t run_cnt = 0;
+
+  qsort (batch, cnt, sizeof *batch, bc_flush_slot_cmp);
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      struct buffer_cache_entry *entry = batch[i].entry;
+
+      lock_acquire (&entry->elock);
+      if (!entry->is_dirty || entry->sector != batch[i].sector)
+        {
+          lock_release (&entry->elock);
+          continue;
+        }
+
+      if (run_cnt > 0 && run[run_cnt - 1]->sector + 1 != entry->sector)
+        {
+          bc_write_run (run, run_cnt);
+          run_cnt = 0;
+        }
+      run[run_cnt++] = entry;
+    }
+
+  if (run_cnt > 0)
+    bc_write_run (run, run_cnt);
+}
+
+/* Writes dirty entries back one batch at a time, without holding
+   anything between batches: every dirty entry if ALL, otherwise
+   what the dirty ratio and age limit call for. Flushers are
+   serialized since a batch holds several elocks at once. */
+static void
+bc_flush_dirty (bool all)
+{
+  struct bc_flush_slot batch[BC_FLUSH_BATCH];
+  size_t cnt;
+
+  lock_acquire (&flush_lock);
+  while ((cnt = bc_collect_dirty (batch, all)) > 0)
+    bc_flush_batch (batch, cnt);
+  lock_release (&flush_lock);
+}
+
+/* Drops SECTOR from the cache without writing it back, once it is
+   freed. A pinned sector must be unpinned by its owner first: its
+   entry could otherwise be reused for another sector, which the
+   owner's late bc_unpin() would then unpin. */
 void bc_remove (block_sector_t sector UNUSED)
 {
 #ifdef ENABLE_BUFFER_CACHE
   lock_acquire(&cache_lock);
-  for (int i = 0; i < MAX_CACHE_SECTORS; i++)
-  {
-    struct buffer_cache_entry *entry = &cache[i];
-    if (entry->sector == sector)
+  struct buffer_cache_entry *entry = bc_get_entry_by_sector (sector);
+  lock_release(&cache_lock);
+
+  if (entry == NULL)
+    return;
+
+  lock_acquire (&entry->elock);
+  lock_acquire(&cache_lock);
+  if (entry->sector == sector) //double check for eviction
     {
-      lock_acquire (&entry->elock);
-      if (entry->sector == sector) //double check for eviction
-        entry->sector = EMPTY_SECTOR;
-      lock_release (&entry->elock);
-      lock_release(&cache_lock);
-      return;
-    }  
-  }
+      bc_mark_clean (entry);
+      if (entry->is_prefetched)
+        bc_stat_add (&stats.ra_wasted, 1);
+      entry->is_prefetched = false;
+      ASSERT (entry->pins == 0);
+      hash_delete (&cache_index, &entry->hash_elem);
+      bc_policy_forget (entry);
+      entry->sector = EMPTY_SECTOR;
+    }
   lock_release(&cache_lock);
+  lock_release (&entry->elock);
 #endif
 }
 
-/* Call with cache lock ENABLED */
-static struct buffer_cache_entry *bc_get_entry_by_sector (block_sector_t sector)
+//**** Pinning
+
+/* Keeps SECTOR resident until the matching bc_unpin(), reading it in
+   if needed. Meant for metadata (inodes, index blocks, the free map,
+   directories) that a stream of data would otherwise push out.
+   Pinned entries are taken off the replacement queues and may only
+   fill BC_PIN_PERCENT of the cache: returns false, without pinning,
+   if that budget is used up. */
+bool bc_pin (block_sector_t sector UNUSED)
 {
-  struct buffer_cache_entry *entry;
-  for (int i = 0; i < MAX_CACHE_SECTORS; i++)
+#ifdef ENABLE_BUFFER_CACHE
+  struct buffer_cache_entry *e = NULL;
+  bool pinned = true;
+
+  if (bc_get_and_lock_entry (&e, sector)) //acquires elock
+    block_read (fs_device, sector, e->data);
+
+  lock_acquire (&cache_lock);
+  if (e->pins == 0)
     {
-      entry = &cache[i];
-      if(entry->sector == sector)
-        return entry;
+      if (pinned_cnt < pinned_max)
+        {
+          pinned_cnt++;
+          bc_queue_move (e, BC_QUEUE_PINNED);
+        }
+      else
+        pinned = false;
     }
+  if (pinned)
+    e->pins++;
+  lock_release (&cache_lock);
+  lock_release (&e->elock);
 
-  return NULL;
+  return pinned;
+#else
+  return false;
+#endif
+}
+
+/* Undoes one successful bc_pin() of SECTOR. The entry goes back to
+   the replacement queues as recently used once the last pin is gone. */
+void bc_unpin (block_sector_t sector UNUSED)
+{
+#ifdef ENABLE_BUFFER_CACHE
+  struct buffer_cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = bc_get_entry_by_sector (sector);
+  ASSERT (e != NULL && e->pins > 0);    /* Pinned entries are never evicted */
+  e->pins--;
+  if (e->pins == 0)
+    {
+      pinned_cnt--;
+      bc_queue_move (e, BC_QUEUE_AM);
+    }
+  lock_release (&cache_lock);
+#endif
+}
+
+/* Call with cache lock ENABLED */
+static struct buffer_cache_entry *bc_get_entry_by_sector (block_sector_t sector)
+{
+  struct buffer_cache_entry key;
+  struct hash_elem *he;
+
+  key.sector = sector;
+  he = hash_find (&cache_index, &key.hash_elem);
+
+  return he != NULL ? hash_entry (he, struct buffer_cache_entry, hash_elem) : NULL;
+}
+
+//**** Hash table functionalities
+
+static unsigned
+bc_sector_hash (const struct hash_elem *he, void *aux UNUSED)
+{
+  struct buffer_cache_entry *entry = 
+  hash_entry (he, struct buffer_cache_entry, hash_elem);
+  return hash_int (entry->sector);
+}
+
+static bool
+bc_sector_less (const struct hash_elem *ha, const struct hash_elem *hb,
+                void *aux UNUSED)
+{
+  struct buffer_cache_entry *a, *b;
+
+  a = hash_entry (ha, struct buffer_cache_entry, hash_elem);
+  b = hash_entry (hb, struct buffer_cache_entry, hash_elem);
+
+  return a->sector < b->sector;
+}
+
+static unsigned
+bc_ghost_hash (const struct hash_elem *he, void *aux UNUSED)
+{
+  struct bc_ghost *ghost = hash_entry (he, struct bc_ghost, hash_elem);
+  return hash_int (ghost->sector);
+}
+
+static bool
+bc_ghost_less (const struct hash_elem *ha, const struct hash_elem *hb,
+               void *aux UNUSED)
+{
+  struct bc_ghost *a, *b;
+
+  a = hash_entry (ha, struct bc_ghost, hash_elem);
+  b = hash_entry (hb, struct bc_ghost, hash_elem);
+
+  return a->sector < b->sector;
 }
 
 
@@ -344,18 +1435,8 @@ static void bc_daemon_flush(void *aux UNUSED)
 { 
   while (true)
     {
-      lock_acquire(&cache_lock);
-      struct buffer_cache_entry *entry;
-      for (int i = 0; i < MAX_CACHE_SECTORS; i++)
-        {
-          entry = &cache[i];
-          lock_acquire (&entry->elock);
-          if(entry->is_dirty)
-            bc_flush (entry);
-          lock_release (&entry->elock);
-        }
-
-      lock_release(&cache_lock);
+      free_map_flush ();
+      bc_flush_dirty (false);
 
       timer_msleep (BC_DAEMON_FLUSH_SLEEP_MS);
     }
@@ -365,30 +1446,31 @@ static void bc_daemon_flush(void *aux UNUSED)
 #ifdef ENABLE_READ_AHEAD
 static void bc_daemon_read_ahead(void *aux UNUSED)
 {
+  struct bc_ra_request r;
+
   while (true)
     {
       sema_down (&rh_sema);
-      //lock_acquire(&cache_lock);
-      for (int i = 0; i < MAX_READ_AHEAD; i++)
+
+      lock_acquire (&ra_lock);
+      ASSERT (ra_cnt > 0);
+      r = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % RA_QUEUE_LEN;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      /* Sectors that follow each other on disk are read together,
+         resident ones and those no entry is free for are skipped */
+      for (size_t i = 0, n; i < r.cnt; i += n)
         {
-          block_sector_t sector = read_ahead [i];
-          if(sector != EMPTY_SECTOR)
+          for (n = 1; i + n < r.cnt && r.sectors[i + n] == r.sectors[i] + n; n++)
+            continue;
+          for (size_t done = 0; done < n;)
             {
-              struct buffer_cache_entry *cache_entry = NULL;
-              bool is_cache_miss = bc_get_and_lock_entry (&cache_entry, sector); //acquires elock
- 
-              lock_acquire(&cache_lock);
-              if(is_cache_miss)
-                  block_read (fs_device, sector, cache_entry->data);
-              lock_release(&cache_lock);
-
-              cache_entry->is_in_second_chance = false;
-              lock_release (&cache_entry->elock);
-
-              read_ahead [i] = EMPTY_SECTOR;
-            }  
+              size_t got = bc_fill (r.sectors[i] + done, n - done, NULL, true);
+              done += got > 0 ? got : 1;
+            }
         }
-      //lock_release(&cache_lock);
     }
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,27 +1,84 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
 #include "devices/block.h"
+#include "filesys/off_t.h"
 #include "threads/synch.h"
 #include <list.h>
+#include <hash.h>
+#include <cache-stats.h>
 
-#define MAX_CACHE_SECTORS 64
-#define BC_DAEMON_FLUSH_SLEEP_MS 1000
-#define MAX_READ_AHEAD 10
+#define DEFAULT_CACHE_SECTORS 64
+#define MIN_CACHE_SECTORS 16
+#define MAX_CACHE_SECTORS 16384
+#define BC_MEMORY_PERCENT 25				/* Of the free kernel pool, at most */
+#define BC_DAEMON_FLUSH_SLEEP_MS 250
+#define DEFAULT_DIRTY_RATIO 10				/* Percent of the cache */
+#define DEFAULT_DIRTY_AGE_MS 1000
+#define BC_FLUSH_BATCH 32					/* Dirty entries written per batch */
+#define BC_RUN_MAX 64						/* Sectors filled by one disk request */
+#define RA_MIN_WINDOW 4					/* Read-ahead window, in sectors */
+#define RA_MAX_WINDOW 64
+#define RA_QUEUE_LEN 8					/* Pending read-ahead requests */
+#define BC_EVICTION_ROUNDS 3
+#define BC_PIN_PERCENT 25					/* Budget for pinned metadata */
 #define EMPTY_SECTOR SIZE_MAX
 
+/* Replacement policies, chosen with -cache-policy at boot */
+enum bc_policy
+{
+	BC_POLICY_CLOCK,					/* Second chance over the whole table */
+	BC_POLICY_2Q						/* Scan resistant 2Q with a ghost list */
+};
+
+#define BC_DEFAULT_POLICY BC_POLICY_2Q
+
+/* 2Q queue an entry belongs to */
+enum bc_queue
+{
+	BC_QUEUE_FREE,						/* Not holding any sector */
+	BC_QUEUE_A1IN,						/* Referenced once, FIFO */
+	BC_QUEUE_AM,						/* Referenced again, LRU */
+	BC_QUEUE_PINNED						/* Pinned metadata, never evicted */
+};
+
 struct buffer_cache_entry
 {
 	block_sector_t sector;              /* Sector number of disk location. */
-	char data [BLOCK_SECTOR_SIZE];		/* Data contained in the cache */
+	char *data;							/* Data contained in the cache (BLOCK_SECTOR_SIZE bytes) */
 	bool is_in_second_chance;			/* Whether the entry is in second chance */			
 	bool is_dirty;						/* Whether the entry is in second dirty */	
-	unsigned int readers;
+	bool is_prefetched;					/* Read ahead and not accessed since */
+	unsigned int readers;				/* Threads copying the data out */
+	unsigned int writers;				/* Writers waiting for the readers */
+	unsigned int waiters;				/* Threads waiting on rw_cond */
+	unsigned int pins;					/* bc_pin() calls not yet undone */
 	struct lock elock;				/* Used to handle asynchronous reads */
+	struct condition rw_cond;			/* Signaled when readers or writers leave */
+	struct hash_elem hash_elem;			/* Element in the sector index */
+	enum bc_queue queue;				/* 2Q queue holding the entry */
+	struct list_elem queue_elem;		/* Element in that queue */
+	struct list_elem dirty_elem;		/* Element in the dirty list */
+	int64_t dirty_since;				/* Timer tick of the first unflushed write */
 };
 
+void bc_configure (size_t sectors);
+bool bc_configure_policy (const char *name);
+void bc_configure_writeback (int dirty_ratio, int dirty_age_ms);
 void bc_init(void);
 void bc_start_daemon (void);
 void bc_block_read (block_sector_t sector, void *buffer, off_t offset, off_t size);
-void bc_request_read_ahead (block_sector_t sector);
+void bc_block_read_multi (block_sector_t sector, size_t cnt, void *buffer);
+void bc_block_read_bypass (block_sector_t sector, size_t cnt, void *buffer);
+void bc_request_read_ahead (const block_sector_t *sectors, size_t cnt);
+size_t bc_read_ahead_limit (void);
 void bc_block_write (block_sector_t sector, void *buffer, off_t offset, off_t size);
+void bc_block_zero (block_sector_t sector, size_t cnt);
 void bc_remove (block_sector_t sector);
+bool bc_pin (block_sector_t sector);
+void bc_unpin (block_sector_t sector);
 void bc_flush_all (void);
+void bc_print_stats (void);
+void bc_get_stats (struct cache_stats *stats);
 
+#endif /* filesys/cache.h */
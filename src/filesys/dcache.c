@@ -0,0 +1,253 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* The name cache remembers, for the names last looked up in each
+   directory, the sector of the inode they name, or that there is no
+   such name, so that walking a path does not need to read the
+   entries of the directories on the way. Directories keep it up to
+   date: they record what they find, add and remove while holding
+   their dir_lock, and forget everything about a directory once it is
+   removed, before its sector can be reused. A lookup holds the same
+   dir_lock until it has opened the inode found, so that the answer
+   cannot go stale in between. An entry for a directory keeps it
+   open, so that opening it again on the way down a path is cheap. */
+
+/* A name looked up in a directory. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_index. */
+    struct list_elem lru_elem;          /* Element in dcache_lru or dcache_free. */
+    block_sector_t dir;                 /* Directory searched. */
+    char name[NAME_MAX + 1];            /* Name searched for. */
+    block_sector_t sector;              /* Its inode, SECTOR_ERROR if none. */
+    bool is_dir;                        /* Does it name a directory? */
+    struct inode *inode;                /* Held open if a directory, or
+                                           a null pointer. */
+  };
+
+static struct dcache_entry dcache[DCACHE_ENTRIES];
+static struct hash dcache_index;        /* Entries by directory and name. */
+static struct list dcache_lru;          /* Entries in use, most recent first. */
+static struct list dcache_free;         /* Entries not in use. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+static struct dcache_entry *dcache_find (block_sector_t dir, const char *name);
+static void dcache_drop (struct dcache_entry *, struct list *dropped);
+static void dcache_close_dropped (struct list *dropped);
+static unsigned dcache_hash (const struct hash_elem *he, void *aux UNUSED);
+static bool dcache_less (const struct hash_elem *ha, const struct hash_elem *hb,
+                         void *aux UNUSED);
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&dcache_index, dcache_hash, dcache_less, NULL);
+  list_init (&dcache_lru);
+  list_init (&dcache_free);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_ENTRIES; i++)
+    list_push_back (&dcache_free, &dcache[i].lru_elem);
+}
+
+/* Looks up NAME in the directory at sector DIR. If the result is
+   known, returns true and sets *SECTOR to the sector of its inode, or
+   to SECTOR_ERROR if DIR has no such name, and *IS_DIR to whether it
+   is a directory. Returns false if the directory must be searched.
+   Call with the directory's dir_lock held, and open the inode found
+   before releasing it. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sector, bool *is_dir)
+{
+  struct dcache_entry *e;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e != NULL)
+    {
+      list_remove (&e->lru_elem);
+      list_push_front (&dcache_lru, &e->lru_elem);
+      *sector = e->sector;
+      *is_dir = e->is_dir;
+    }
+  lock_release (&dcache_lock);
+
+  return e != NULL;
+}
+
+/* Records that NAME in the directory at sector DIR is the inode at
+   SECTOR, a directory if IS_DIR, or is not there if SECTOR is
+   SECTOR_ERROR. INODE, if not a null pointer, is that inode, open,
+   and is kept open if it is a directory. Replaces the least recently
+   used entry if the cache is full. Call with the directory's dir_lock
+   held. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t sector, bool is_dir, struct inode *inode)
+{
+  struct dcache_entry *e;
+  struct inode *old;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e != NULL)
+    list_remove (&e->lru_elem);
+  else if (list_empty (&dcache_free) && list_empty (&dcache_lru))
+    {
+      /* Every entry is being dropped by another thread */
+      lock_release (&dcache_lock);
+      return;
+    }
+  else
+    {
+      if (!list_empty (&dcache_free))
+        e = list_entry (list_pop_front (&dcache_free),
+                        struct dcache_entry, lru_elem);
+      else
+        {
+          e = list_entry (list_pop_back (&dcache_lru),
+                          struct dcache_entry, lru_elem);
+          hash_delete (&dcache_index, &e->hash_elem);
+        }
+      e->dir = dir;
+      strlcpy (e->name, name, sizeof e->name);
+      hash_insert (&dcache_index, &e->hash_elem);
+    }
+  old = e->inode;
+  e->sector = sector;
+  e->is_dir = is_dir;
+  e->inode = is_dir && inode != NULL ? inode_reopen (inode) : NULL;
+  list_push_front (&dcache_lru, &e->lru_elem);
+  lock_release (&dcache_lock);
+
+  /* Closing may write it back */
+  inode_close (old);
+}
+
+/* Forgets every name looked up in the directory at sector DIR, which
+   is being removed. */
+void
+dcache_forget_dir (block_sector_t dir)
+{
+  struct list_elem *elem, *next;
+  struct list dropped;
+
+  list_init (&dropped);
+  lock_acquire (&dcache_lock);
+  for (elem = list_begin (&dcache_lru); elem != list_end (&dcache_lru);
+       elem = next)
+    {
+      struct dcache_entry *e = list_entry (elem, struct dcache_entry,
+                                           lru_elem);
+      next = list_next (elem);
+      if (e->dir == dir)
+        dcache_drop (e, &dropped);
+    }
+  lock_release (&dcache_lock);
+
+  dcache_close_dropped (&dropped);
+}
+
+/* Forgets every name, closing the directories held open, so that
+   they are written back before the file system shuts down. */
+void
+dcache_done (void)
+{
+  struct list dropped;
+
+  list_init (&dropped);
+  lock_acquire (&dcache_lock);
+  while (!list_empty (&dcache_lru))
+    dcache_drop (list_entry (list_front (&dcache_lru),
+                             struct dcache_entry, lru_elem), &dropped);
+  lock_release (&dcache_lock);
+
+  dcache_close_dropped (&dropped);
+}
+
+/* Removes E from the cache and moves it to DROPPED, so that the
+   inode it holds open can be closed once dcache_lock is released.
+   Call with dcache_lock held. */
+static void
+dcache_drop (struct dcache_entry *e, struct list *dropped)
+{
+  hash_delete (&dcache_index, &e->hash_elem);
+  list_remove (&e->lru_elem);
+  list_push_back (dropped, &e->lru_elem);
+}
+
+/* Closes the inodes held by the entries in DROPPED, which may write
+   them back, then returns the entries to dcache_free. */
+static void
+dcache_close_dropped (struct list *dropped)
+{
+  struct list_elem *elem;
+
+  if (list_empty (dropped))
+    return;
+
+  for (elem = list_begin (dropped); elem != list_end (dropped);
+       elem = list_next (elem))
+    {
+      struct dcache_entry *e = list_entry (elem, struct dcache_entry,
+                                           lru_elem);
+      inode_close (e->inode);
+      e->inode = NULL;
+    }
+
+  lock_acquire (&dcache_lock);
+  while (!list_empty (dropped))
+    list_push_back (&dcache_free, list_pop_front (dropped));
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer. Call with
+   dcache_lock held. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *he;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  he = hash_find (&dcache_index, &key.hash_elem);
+  return he != NULL ? hash_entry (he, struct dcache_entry, hash_elem) : NULL;
+}
+
+static unsigned
+dcache_hash (const struct hash_elem *he, void *aux UNUSED)
+{
+  struct dcache_entry *e = hash_entry (he, struct dcache_entry, hash_elem);
+
+  return hash_string (e->name) ^ hash_int (e->dir);
+}
+
+static bool
+dcache_less (const struct hash_elem *ha, const struct hash_elem *hb,
+             void *aux UNUSED)
+{
+  struct dcache_entry *a, *b;
+
+  a = hash_entry (ha, struct dcache_entry, hash_elem);
+  b = hash_entry (hb, struct dcache_entry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -0,0 +1,20 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+struct inode;
+
+/* Name lookups remembered. */
+#define DCACHE_ENTRIES 256
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector, bool *is_dir);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector, bool is_dir, struct inode *);
+void dcache_forget_dir (block_sector_t dir);
+void dcache_done (void);
+
+#endif /* filesys/dcache.h */
@@ -1,13 +1,49 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
-#define DIR_CHECK (is_dir ? (e.is_dir) : (true))
+/* A directory starts out as an array of entries, searched in order.
+   Once it outgrows DIR_HASH_THRESHOLD entries it is rewritten as a
+   hash table: a header sector followed by a power of two of buckets,
+   one sector each. A name is stored in the bucket its hash selects
+   or, if that one is full, in one of the buckets after it, which are
+   then marked as overflowed so that lookups go on past them. The
+   table doubles before it is three quarters full, so finding, adding
+   or removing a name reads a couple of sectors whatever the size of
+   the directory. */
+#define DIR_HASH_THRESHOLD 16
+
+/* Entries in a bucket. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                        / sizeof (struct dir_entry))
+
+/* First sector of a hashed directory. */
+struct dir_header
+  {
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+  };
+
+/* A sector of entries of a hashed directory. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint32_t overflow;                  /* Entries that hash here or before
+                                           may be in later buckets. */
+  };
+
+static bool hashed_lookup (struct inode *, const char *name,
+                         struct dir_entry *, off_t *);
+static bool hashed_add (struct inode *, const struct dir_entry *);
+static bool hashed_convert (struct inode *);
 
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
@@ -26,8 +62,9 @@ dir_open (struct inode *inode)
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
-      lock_init (&dir->dir_lock);
       dir->pos = 0;
+      /* Lookups always start from the first entries */
+      inode_pin (inode, 0);
       return dir;
     }
   else
@@ -87,6 +124,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (inode_is_hashed_dir (dir->inode))
+    return hashed_lookup (dir->inode, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -100,6 +140,66 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Opens the inode named NAME in the directory DIR_INODE, sets
+   *IS_DIR to whether it is a directory and returns it, or returns a
+   null pointer if there is no such name. ".." names the parent
+   directory. The answer comes from the name cache if it is there,
+   otherwise the directory is searched and the answer cached. Either
+   way the inode is opened before DIR_INODE's dir_lock is released,
+   so that the name cannot be removed and its sector reused in
+   between: the name cache is only changed under that lock too. */
+static struct inode *
+lookup_inode (struct inode *dir_inode, const char *name, bool *is_dir)
+{
+  struct dir_entry e;
+  struct dir dir;
+  block_sector_t sector;
+  struct inode *inode = NULL;
+
+  dir.inode = dir_inode;
+  dir.pos = 0;
+
+  /* Adding an entry may rearrange a hashed directory */
+  lock_acquire (&dir_inode->dir_lock);
+  if (dir_inode->removed)
+    {
+      /* Its parent may be gone too */
+      lock_release (&dir_inode->dir_lock);
+      return NULL;
+    }
+  if (dcache_lookup (inode_get_inumber (dir_inode), name, &sector, is_dir))
+    {
+      if (sector != SECTOR_ERROR)
+        inode = inode_open (sector);
+    }
+  else
+    {
+      if (!strcmp (name, ".."))
+        {
+          sector = inode_get_parent (dir_inode);
+          *is_dir = true;
+        }
+      else if (lookup (&dir, name, &e, NULL))
+        {
+          sector = e.inode_sector;
+          *is_dir = e.is_dir;
+        }
+      else
+        {
+          sector = SECTOR_ERROR;
+          *is_dir = false;
+        }
+      if (sector != SECTOR_ERROR)
+        inode = inode_open (sector);
+      if (sector == SECTOR_ERROR || inode != NULL)
+        dcache_insert (inode_get_inumber (dir_inode), name, sector, *is_dir,
+                       inode);
+    }
+  lock_release (&dir_inode->dir_lock);
+
+  return inode;
+}
+
 /* Searches DIR for a file or folder with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -108,67 +208,82 @@ bool
 dir_lookup_entry (const struct dir *dir, const char *name,
             struct inode **inode, bool is_dir) 
 {
-  struct dir_entry e;
+  bool entry_is_dir;
 
-  if (dir != NULL && name != NULL && lookup (dir, name, &e, NULL) && DIR_CHECK)
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  *inode = NULL;
+  if (dir != NULL && name != NULL && strcmp (name, ".") && strcmp (name, ".."))
+    {
+      *inode = lookup_inode (dir->inode, name, &entry_is_dir);
+      if (*inode != NULL && is_dir && !entry_is_dir)
+        {
+          inode_close (*inode);
+          *inode = NULL;
+        }
+    }
+
+  return *inode != NULL;
+}
+
+/* Copies the next entry of the path at P into NAME, or an empty
+   string if it is longer than NAME_MAX, and returns where the rest
+   of the path starts. Returns a null pointer if there are no entries
+   left. */
+static const char *
+next_path_entry (const char *p, char name[NAME_MAX + 1])
+{
+  size_t len;
 
-  return *inode != NULL && DIR_CHECK;
+  while (*p == '/')
+    p++;
+  if (*p == '\0')
+    return NULL;
+
+  len = strcspn (p, "/");
+  if (len <= NAME_MAX)
+    {
+      memcpy (name, p, len);
+      name[len] = '\0';
+    }
+  else
+    name[0] = '\0';
+  return p + len;
 }
 
-/* Caller must close the returned inode */
+/* Returns the directory at PATH_STR, or a null pointer if there is
+   none. The path is parsed in one pass and walked from directory to
+   directory through the name cache, so that only the directories
+   whose entries are not cached get searched.
+   Caller must close the returned inode */
 struct inode *
 dir_path_lookup (const char *path_str)
 {
+  char name[NAME_MAX + 1];
+  struct inode *inode;
+  struct inode *next;
+  bool is_dir;
+
   if (path_str == NULL || !path_str_wellformed (path_str))
     return NULL;
 
-  struct dir *working_dir = NULL;
-  struct dir *prev_working_dir = NULL;
-  struct inode *inode = NULL;
-  block_sector_t working_dir_sector;
-  char dir_entry_name[NAME_MAX + 1];
-  const char *target = get_path_last_entry (path_str);
-  int last_entry_idx = get_path_entry_cnt (path_str) - 1;
-
-  if (path_str[0] == '/')
-  { // Absolute path
-    if (path_str[1] == '\0')
-      return inode_open (ROOT_DIR_SECTOR);
-
-    working_dir = dir_open_root ();
-  }
+  if (path_str[0] == '/' || thread_current ()->curr_dir == NULL)
+    inode = inode_open (ROOT_DIR_SECTOR);
   else
-  { // Relative path
-    working_dir = get_curr_working_dir ();
-  }
-
-  for (int i = 0; strcmp (dir_entry_name, target) || i <= last_entry_idx; i++)
-  {
-    get_path_entry (path_str, i, dir_entry_name);
+    inode = inode_reopen (dir_get_inode (thread_current ()->curr_dir));
 
-    if (!strcmp (dir_entry_name, "."))
+  while (inode != NULL
+         && (path_str = next_path_entry (path_str, name)) != NULL)
     {
-      inode = dir_get_inode (working_dir);
-      continue;
-    }
-    else if (!strcmp (dir_entry_name, ".."))
-    {
-      working_dir_sector = inode_get_parent (dir_get_inode (working_dir));
-      working_dir = dir_open (inode_open (working_dir_sector));
-      inode = dir_get_inode (working_dir);
-    }
-    else
-    {
-      if (!dir_lookup_entry (working_dir, dir_entry_name, &inode, true))
-        return NULL;
-      working_dir = dir_open (inode);
+      if (!strcmp (name, "."))
+        continue;
+      next = name[0] != '\0' ? lookup_inode (inode, name, &is_dir) : NULL;
+      inode_close (inode);
+      inode = next;
+      if (inode != NULL && !is_dir)
+        {
+          inode_close (inode);
+          inode = NULL;
+        }
     }
-    dir_close (prev_working_dir);
-    prev_working_dir = working_dir;
-  }
 
   return inode;
 }
@@ -182,7 +297,6 @@ dir_path_lookup (const char *path_str)
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 {
-  lock_acquire (&dir->dir_lock);
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -194,32 +308,65 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Changes to the same directory are serialized through its inode,
+     shared by every opener */
+  lock_acquire (&dir->inode->dir_lock);
+
+  /* Check that the directory is still linked and NAME is not in use. */
+  if (dir->inode->removed || lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  if (!inode_is_hashed_dir (dir->inode))
+    {
+      struct dir_entry slot;
+
+      /* Set OFS to offset of free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
+
+         inode_read_at() will only return a short read at end of file.
+         Otherwise, we'd need to verify that we didn't get a short
+         read due to something intermittent such as low memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &slot, sizeof slot, ofs) == sizeof slot;
+           ofs += sizeof slot)
+        if (!slot.in_use)
+          break;
+
+      /* Write slot, unless the directory is now too large to search
+         in order. */
+      if (ofs < DIR_HASH_THRESHOLD * (off_t) sizeof e)
+        {
+          memset (&e, 0, sizeof e);
+          strlcpy (e.name, name, sizeof e.name);
+          e.inode_sector = inode_sector;
+          e.in_use = true;
+          e.is_dir = is_dir;
+          success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+          goto done;
+        }
+      if (!hashed_convert (dir->inode))
+        goto done;
+    }
 
-  /* Write slot. */
+  memset (&e, 0, sizeof e);
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   e.in_use = true;
   e.is_dir = is_dir;
-
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = hashed_add (dir->inode, &e);
 
  done:
-  lock_release (&dir->dir_lock);
+  if (success)
+    {
+      /* A directory is kept open by its entry in the name cache */
+      struct inode *inode = is_dir ? inode_open (inode_sector) : NULL;
+
+      dcache_insert (inode_get_inumber (dir->inode), name, inode_sector,
+                     is_dir, inode);
+      inode_close (inode);
+    }
+  lock_release (&dir->inode->dir_lock);
   return success;
 }
 
@@ -230,7 +377,6 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  lock_acquire (&dir->dir_lock);
   struct dir_entry e;
   struct inode *inode = NULL;
   struct dir *dir_to_remove = NULL;
@@ -240,6 +386,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir->inode->dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -249,27 +397,50 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Remove directory only if it's empty */
+  /* Remove directory only if it's empty. Its own lock, taken parent
+     first like every path walk, keeps entries from being added until
+     it is marked removed */
   if (e.is_dir)
   {
-    dir_to_remove = dir_open (inode);
-    if (!dir_is_empty (dir_to_remove))
+    dir_to_remove = dir_open (inode_reopen (inode));
+    if (dir_to_remove == NULL)
       goto done;
+    lock_acquire (&inode->dir_lock);
+    if (!dir_is_empty (dir_to_remove))
+      {
+        lock_release (&inode->dir_lock);
+        goto done;
+      }
   }
 
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
-
-  /* Remove inode. */
-  inode_remove (inode);
-  success = true;
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e) 
+    {
+      if (inode_is_hashed_dir (dir->inode))
+        {
+          struct dir_header h;
+
+          inode_read_at (dir->inode, &h, sizeof h, 0);
+          h.entry_cnt--;
+          inode_write_at (dir->inode, &h, sizeof h, 0);
+        }
+
+      /* Remove inode. */
+      inode_remove (inode);
+      dcache_insert (inode_get_inumber (dir->inode), name, SECTOR_ERROR,
+                     false, NULL);
+      if (dir_to_remove != NULL)
+        dcache_forget_dir (e.inode_sector);
+      success = true;
+    }
+  if (dir_to_remove != NULL)
+    lock_release (&inode->dir_lock);
 
  done:
   dir_close (dir_to_remove);
   inode_close (inode);
-  lock_release (&dir->dir_lock);
+  lock_release (&dir->inode->dir_lock);
   return success;
 }
 
@@ -280,17 +451,45 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  off_t end = -1;
+  bool found = false;
+
+  lock_acquire (&dir->inode->dir_lock);
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* In a hashed directory, step over the header and the end of each
+     bucket */
+  if (inode_is_hashed_dir (dir->inode))
+    {
+      struct dir_header h;
+
+      off_t in_sector = dir->pos % BLOCK_SECTOR_SIZE;
+
+      inode_read_at (dir->inode, &h, sizeof h, 0);
+      end = (h.bucket_cnt + 1) * BLOCK_SECTOR_SIZE;
+      if (dir->pos < BLOCK_SECTOR_SIZE)
+        dir->pos = BLOCK_SECTOR_SIZE;
+      else if (in_sector % sizeof e != 0
+               || in_sector / sizeof e >= BUCKET_ENTRIES)
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+    }
+
+  while ((end < 0 || dir->pos < end)
+         && inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
     {
       dir->pos += sizeof e;
+      if (end >= 0 && (dir->pos % BLOCK_SECTOR_SIZE)
+                      / sizeof e == BUCKET_ENTRIES)
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+
+  lock_release (&dir->inode->dir_lock);
+  return found;
 }
 
 bool
@@ -335,24 +534,6 @@ get_path_entry (const char *path_str, int n, char *buffer)
   }
 }
 
-int
-get_path_entry_cnt (const char *path_str)
-{
-  char *save_ptr, *token, *cpy = calloc (strlen (path_str)+1, sizeof (char));
-  strlcpy (cpy, path_str, strlen (path_str)+1);
-  int cnt = 0;
-
-  token = strtok_r (cpy, "/", &save_ptr);
-  while (token != NULL)
-  {
-    token = strtok_r (NULL, "/", &save_ptr);
-    cnt++;
-  }
-
-  free (cpy);
-  return cnt;
-}
-
 /* Caller must close the returned open directory.
    The parent may not be accessible as the inode for the 
    child may not exist yet: it's important to use only
@@ -418,9 +599,233 @@ dir_is_empty (struct dir *dir)
   size_t ofs;
   ASSERT (dir != NULL);
 
+  if (inode_is_hashed_dir (dir->inode))
+    {
+      struct dir_header h;
+
+      return (inode_read_at (dir->inode, &h, sizeof h, 0) == sizeof h
+              && h.entry_cnt == 0);
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
     if (e.in_use)
       return false;
 
   return true;
-}
\ No newline at end of file
+}
+/* Returns the offset of bucket B of a hashed directory. */
+static off_t
+bucket_ofs (size_t b)
+{
+  return (b + 1) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the bucket NAME hashes to in a table of BUCKET_CNT. */
+static size_t
+home_bucket (const char *name, size_t bucket_cnt)
+{
+  return hash_string (name) & (bucket_cnt - 1);
+}
+
+/* Searches the hashed directory INODE for NAME, as lookup(). */
+static bool
+hashed_lookup (struct inode *inode, const char *name,
+             struct dir_entry *ep, off_t *ofsp)
+{
+  struct dir_header h;
+  struct dir_bucket *bucket;
+  bool found = false;
+  size_t b, i, j;
+
+  if (inode_read_at (inode, &h, sizeof h, 0) != sizeof h)
+    return false;
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+
+  b = home_bucket (name, h.bucket_cnt);
+  for (i = 0; i < h.bucket_cnt && !found; i++)
+    {
+      if (inode_read_at (inode, bucket, sizeof *bucket, bucket_ofs (b))
+          != sizeof *bucket)
+        break;
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        {
+          struct dir_entry *e = &bucket->entries[j];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = bucket_ofs (b) + j * sizeof *e;
+              found = true;
+              break;
+            }
+        }
+      if (!bucket->overflow)
+        break;
+      b = (b + 1) & (h.bucket_cnt - 1);
+    }
+
+  free (bucket);
+  return found;
+}
+
+/* Stores E in the first free slot of the hashed directory INODE,
+   whose header is H, starting at its home bucket. The header is not
+   changed. */
+static bool
+hashed_insert (struct inode *inode, const struct dir_header *h,
+             const struct dir_entry *e, struct dir_bucket *bucket)
+{
+  size_t b = home_bucket (e->name, h->bucket_cnt);
+  size_t i, j;
+
+  for (i = 0; i < h->bucket_cnt; i++)
+    {
+      off_t ofs = bucket_ofs (b);
+
+      if (inode_read_at (inode, bucket, sizeof *bucket, ofs) != sizeof *bucket)
+        return false;
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (!bucket->entries[j].in_use)
+          return inode_write_at (inode, e, sizeof *e, ofs + j * sizeof *e)
+                 == sizeof *e;
+
+      if (!bucket->overflow)
+        {
+          bucket->overflow = 1;
+          if (inode_write_at (inode, &bucket->overflow,
+                              sizeof bucket->overflow,
+                              ofs + offsetof (struct dir_bucket, overflow))
+              != sizeof bucket->overflow)
+            return false;
+        }
+      b = (b + 1) & (h->bucket_cnt - 1);
+    }
+  return false;
+}
+
+/* Doubles the number of buckets of the hashed directory INODE,
+   whose header is H, and moves every entry to its place in the larger
+   table. Each old bucket is emptied and its entries stored again in
+   turn. An emptied bucket keeps its overflow mark: an entry moved
+   earlier in the pass may have been stored past it while it was still
+   full, and must still be found from its new home. */
+static bool
+hashed_grow (struct inode *inode, struct dir_header *h)
+{
+  struct dir_bucket *bucket = malloc (sizeof *bucket);
+  struct dir_bucket *old = malloc (sizeof *old);
+  size_t old_cnt = h->bucket_cnt;
+  bool success = false;
+  size_t b, j;
+
+  /* Take the space up front, so as not to fail halfway */
+  if (bucket == NULL || old == NULL
+      || !inode_allocate (inode, bucket_ofs (2 * old_cnt), false))
+    goto done;
+
+  memset (bucket, 0, sizeof *bucket);
+  for (b = old_cnt; b < 2 * old_cnt; b++)
+    if (inode_write_at (inode, bucket, sizeof *bucket, bucket_ofs (b))
+        != sizeof *bucket)
+      goto done;
+  h->bucket_cnt = 2 * old_cnt;
+  if (inode_write_at (inode, h, sizeof *h, 0) != sizeof *h)
+    goto done;
+
+  for (b = 0; b < old_cnt; b++)
+    {
+      if (inode_read_at (inode, old, sizeof *old, bucket_ofs (b))
+          != sizeof *old)
+        goto done;
+      memset (bucket, 0, sizeof *bucket);
+      bucket->overflow = old->overflow;
+      if (inode_write_at (inode, bucket, sizeof *bucket, bucket_ofs (b))
+          != sizeof *bucket)
+        goto done;
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (old->entries[j].in_use
+            && !hashed_insert (inode, h, &old->entries[j], bucket))
+          goto done;
+    }
+  success = true;
+
+ done:
+  free (old);
+  free (bucket);
+  return success;
+}
+
+/* Adds E to the hashed directory INODE, growing the table first if
+   it is getting full. */
+static bool
+hashed_add (struct inode *inode, const struct dir_entry *e)
+{
+  struct dir_header h;
+  struct dir_bucket *bucket;
+  bool success = false;
+
+  if (inode_read_at (inode, &h, sizeof h, 0) != sizeof h)
+    return false;
+  if ((h.entry_cnt + 1) * 4 > h.bucket_cnt * BUCKET_ENTRIES * 3
+      && !hashed_grow (inode, &h))
+    return false;
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket != NULL && hashed_insert (inode, &h, e, bucket))
+    {
+      h.entry_cnt++;
+      success = inode_write_at (inode, &h, sizeof h, 0) == sizeof h;
+    }
+  free (bucket);
+  return success;
+}
+
+/* Rewrites the directory INODE, an array of entries, as a hash
+   table. */
+static bool
+hashed_convert (struct inode *inode)
+{
+  struct dir_header h = { 4, 0 };
+  struct dir_entry *entries;
+  struct dir_bucket *bucket;
+  size_t slot_cnt = inode_length (inode) / sizeof *entries;
+  size_t cnt = 0;
+  bool success = false;
+  size_t i;
+
+  entries = malloc (slot_cnt * sizeof *entries);
+  bucket = calloc (1, sizeof *bucket);
+  if (entries == NULL || bucket == NULL)
+    goto done;
+  for (i = 0; i < slot_cnt; i++)
+    if (inode_read_at (inode, &entries[cnt], sizeof *entries,
+                       i * sizeof *entries) == sizeof *entries
+        && entries[cnt].in_use)
+      cnt++;
+
+  while (cnt * 4 > h.bucket_cnt * BUCKET_ENTRIES * 3)
+    h.bucket_cnt *= 2;
+  if (!inode_allocate (inode, bucket_ofs (h.bucket_cnt), false))
+    goto done;
+  for (i = 0; i < h.bucket_cnt; i++)
+    if (inode_write_at (inode, bucket, sizeof *bucket, bucket_ofs (i))
+        != sizeof *bucket)
+      goto done;
+  for (i = 0; i < cnt; i++)
+    if (!hashed_insert (inode, &h, &entries[i], bucket))
+      goto done;
+  h.entry_cnt = cnt;
+  if (inode_write_at (inode, &h, sizeof h, 0) != sizeof h)
+    goto done;
+
+  inode_set_hashed_dir (inode);
+  success = true;
+
+ done:
+  free (bucket);
+  free (entries);
+  return success;
+}
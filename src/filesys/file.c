@@ -1,6 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -15,6 +16,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -52,6 +56,45 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Updates the read-ahead stream of FILE after BYTES_READ bytes were
+   read at OFFSET. A read starting where the previous one ended doubles
+   the window, from RA_MIN_WINDOW up to bc_read_ahead_limit() sectors;
+   any other read halves it, down to no read-ahead at all. The window
+   past the read is prefetched in one request once half of what was
+   prefetched before has been consumed. */
+static void
+file_read_ahead (struct file *file, off_t offset, off_t bytes_read)
+{
+  off_t next = offset + bytes_read;
+  size_t limit = bc_read_ahead_limit ();
+
+  if (bytes_read > 0 && offset == file->ra_next)
+    file->ra_window = file->ra_window == 0 ? RA_MIN_WINDOW
+                                           : file->ra_window * 2;
+  else
+    {
+      file->ra_window /= 2;
+      if (file->ra_window < RA_MIN_WINDOW)
+        file->ra_window = 0;
+      file->ra_end = next;
+    }
+  if (file->ra_window > limit)
+    file->ra_window = limit;
+  file->ra_next = next;
+
+  if (file->ra_window == 0)
+    return;
+
+  off_t window = file->ra_window * BLOCK_SECTOR_SIZE;
+  if (file->ra_end < next)
+    file->ra_end = next;
+  if (file->ra_end - next > window / 2)
+    return;
+
+  inode_read_ahead (file->inode, file->ra_end, next + window - file->ra_end);
+  file->ra_end = next + window;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -61,6 +104,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -73,7 +117,20 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Reads SIZE bytes, at most a page, from FILE into PAGE, starting at
+   offset FILE_OFS in the file. PAGE is a frame that keeps its own
+   copy of the data, see inode_read_page().
+   Returns the number of bytes actually read.
+   The file's current position is unaffected. */
+off_t
+file_read_page (struct file *file, void *page, off_t size, off_t file_ofs) 
+{
+  return inode_read_page (file->inode, page, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -105,6 +162,17 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reserves disk space for the first SIZE bytes of FILE, so that
+   writing them does not allocate, growing FILE to SIZE bytes unless
+   KEEP_SIZE. Returns false if the disk is full or writes are
+   denied. */
+bool
+file_allocate (struct file *file, off_t size, bool keep_size)
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, size, keep_size);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -3,6 +3,7 @@
 
 #include "filesys/off_t.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 struct inode;
 
@@ -13,6 +14,9 @@ struct file
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
     bool memory_mapped;
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of what was already prefetched. */
+    size_t ra_window;           /* Read-ahead window in sectors, 0: off. */
   };
 
 /* Opening and closing files. */
@@ -24,8 +28,10 @@ struct inode *file_get_inode (struct file *);
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_read_page (struct file *, void *page, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+bool file_allocate (struct file *, off_t size, bool keep_size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
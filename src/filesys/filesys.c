@@ -5,6 +5,7 @@
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/dcache.h"
 #include "filesys/directory.h"
 #include "cache.h"
 
@@ -24,10 +25,13 @@ filesys_init (bool format)
 
   bc_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
+  else
+    inode_detect_layout ();
 
   free_map_open ();
 }
@@ -37,8 +41,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  bc_flush_all();
+  dcache_done ();
   free_map_close ();
+  bc_flush_all();
 }
 
 /* Creates a file or directory named NAME with the given INITIAL_SIZE.
@@ -60,7 +65,13 @@ filesys_create (const char *path, off_t initial_size)
     return false;
   parent_dir_sector = inode_get_inumber (dir_get_inode (parent_dir));
 
-  success = free_map_allocate (1, &inode_sector);
+  /* Files go near their directory, directories where there is room
+     for theirs */
+  if (initial_size >= 0)
+    success = free_map_allocate_near (parent_dir_sector, 1, &inode_sector);
+  else
+    success = free_map_allocate_near (free_map_dir_hint (parent_dir_sector),
+                                      1, &inode_sector);
   if (initial_size >= 0)
   {
     success = success && inode_create (inode_sector, initial_size, parent_dir_sector, false); // Create file
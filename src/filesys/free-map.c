@@ -1,13 +1,35 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "filesys/cache.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Place new sectors near a hint, see free_map_allocate_near(), rather
+   than in the first free space from the start of the disk. */
+#define ENABLE_ALLOCATION_GROUPS
+
+/* Sectors per allocation group. */
+#define GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* Sectors of the file behind free_map. */
+static struct lock free_map_lock;    /* Protects free_map and its file. */
+static size_t group_cnt;             /* Allocation groups on the disk. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+/* Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void free_map_pin (void);
+static void free_map_update (block_sector_t, size_t, bool used);
+static void free_map_count_groups (void);
+static block_sector_t free_map_scan (block_sector_t hint, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -16,45 +38,212 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                          BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. The change reaches the free map file at
+   the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first CNT free sectors at
+   or after HINT in its allocation group, or else in the groups that
+   follow, wrapping around the disk. Callers pass the sector the new
+   ones will be read along with: the inode for its data, the previous
+   data sector to continue a file, the parent directory for an inode. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = free_map_scan (hint, cnt);
+  if (sector != BITMAP_ERROR)
+    free_map_update (sector, cnt, true);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Returns where to start looking for the sector of a new directory
+   made in the directory at PARENT: near PARENT while its group has at
+   least the average free space, otherwise in the group with the
+   most, so that the files later made in it have room to stay near
+   it. */
+block_sector_t
+free_map_dir_hint (block_sector_t parent)
+{
+  size_t g = parent / GROUP_SECTORS;
+  size_t best = g;
+  size_t total = 0;
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < group_cnt; i++)
+    total += group_free[i];
+  if (group_free[g] * group_cnt < total)
+    for (i = 0; i < group_cnt; i++)
+      if (group_free[i] > group_free[best])
+        best = i;
+  lock_release (&free_map_lock);
+
+  return best == g ? parent : best * GROUP_SECTORS;
+}
+
+/* Returns the first of CNT free sectors found as described for
+   free_map_allocate_near(), or BITMAP_ERROR. Groups with fewer free
+   sectors than CNT are skipped without looking at their bits. Call
+   with free_map_lock held. */
+static block_sector_t
+free_map_scan (block_sector_t hint, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t first_group;
+  size_t i;
+
+#ifndef ENABLE_ALLOCATION_GROUPS
+  hint = 0;
+#endif
+  if (hint >= size)
+    hint = 0;
+  first_group = hint / GROUP_SECTORS;
+
+  /* The last round covers the part of the first group before HINT */
+  for (i = 0; i <= group_cnt && cnt <= GROUP_SECTORS; i++)
+    {
+      size_t g = (first_group + i) % group_cnt;
+      size_t start = i == 0 ? hint : g * GROUP_SECTORS;
+      size_t end = i == group_cnt ? hint : (g + 1) * GROUP_SECTORS;
+      size_t sector;
+
+      if (group_free[g] < cnt || start >= end)
+        continue;
+      sector = bitmap_scan (free_map, start, cnt, false);
+      if (sector != BITMAP_ERROR && sector < end)
+        return sector;
+    }
+
+  /* Runs longer than a group, or only found across group boundaries */
+  return bitmap_scan (free_map, 0, cnt, false);
+}
+
+/* Allocates up to CNT consecutive sectors starting exactly at
+   SECTOR, stopping at the first one in use, and returns how many
+   were allocated. Used to extend a run of sectors in place. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  while (n < cnt && sector + n < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + n))
+    n++;
+
+  if (n > 0)
+    free_map_update (sector, n, true);
+  lock_release (&free_map_lock);
+  return n;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  /* Drop the cached sectors first: once released they may be
+     allocated and written by someone else */
+  for (size_t i = 0; i < cnt; i++)
+    bc_remove (sector + i);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
-
-  while (cnt > 0)
-  {
-    bc_remove (sector);
-    sector ++;
-    cnt --;
-  }
+  free_map_update (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Marks the CNT sectors starting at SECTOR as USED or free, keeping
+   the free counts of their groups, and marks the sectors of the free
+   map file holding their bits as changed. Call with free_map_lock
+   held. */
+static void
+free_map_update (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  block_sector_t end = sector + cnt;
+
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+
+  while (sector < end)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      block_sector_t group_end = (g + 1) * GROUP_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - sector;
+
+      if (used)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      sector += n;
+    }
+}
+
+/* Counts the free sectors of every group from the free map. */
+static void
+free_map_count_groups (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t cnt = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Writes the sectors of the free map file whose bits changed since
+   they were last written. Called by the buffer cache's periodic flush
+   and when the free map is closed, so that a burst of allocations
+   costs one write of each sector it touched. */
+void
+free_map_flush (void)
+{
+  size_t idx;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    while ((idx = bitmap_scan_and_flip (dirty_map, 0, 1, true))
+           != BITMAP_ERROR)
+      if (!bitmap_write_range (free_map, free_map_file,
+                               idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        {
+          bitmap_mark (dirty_map, idx);
+          break;
+        }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -66,13 +255,19 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_map_count_groups ();
+  free_map_pin ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -84,10 +279,25 @@ free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), FREE_MAP_SECTOR, false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file. The new file is a hole: writing it
+     allocates its sectors, and the flush stores those allocations. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  free_map_flush ();
+  free_map_pin ();
+}
+
+/* Keeps the free map sectors in the buffer cache, every flush of
+   the free map writes some of them. */
+static void
+free_map_pin (void)
+{
+  struct inode *inode = file_get_inode (free_map_file);
+  off_t length = inode_length (inode);
+
+  for (off_t ofs = 0; ofs < length; ofs += BLOCK_SECTOR_SIZE)
+    inode_pin (inode, ofs);
 }
@@ -10,12 +10,21 @@
 
 #define FIRST_VALID_FILE_DESCRIPTOR 2;
 
+/* There is no global file system lock: inodes, directories and the
+   free map synchronize themselves. fd_lock only protects the table of
+   file descriptors and the open_fd_cnt and cwd_cnt of directories,
+   and is never held across file system calls that do I/O. A
+   directory that gains an opener between the check in
+   remove_file_or_dir() and its removal is removed anyway, which
+   leaves that opener with an empty directory that cannot be added
+   to, as if it had been removed right after. */
 static struct list open_files;
+static struct lock fd_lock;
 
 void
 fsaccess_init (void)
 {
-  lock_init (&files_lock);
+  lock_init (&fd_lock);
   list_init (&open_files);
   fd_count = FIRST_VALID_FILE_DESCRIPTOR;
 }
@@ -25,11 +34,7 @@ create_file(const char *filepath, unsigned length)
 {
   bool result = false;
   if (is_valid_address_of_thread (thread_current (), filepath, false, 0) && strlen (filepath))
-    {
-      lock_fs ();
-      result = filesys_create(filepath, length);
-      unlock_fs ();
-    }
+    result = filesys_create(filepath, length);
   
   return result;
 }
@@ -55,21 +60,17 @@ change_directory(const char *dirpath)
   if (dirpath == NULL)
     return false;
 
-  lock_fs ();
-
   if ((new_dir = dir_open (dir_path_lookup (dirpath))) == NULL)
-  {
-    unlock_fs ();
     return false;
-  }
 
+  lock_acquire (&fd_lock);
   old_dir = get_curr_working_dir ();
   old_dir->inode->cwd_cnt--;
-  dir_close (old_dir);
   new_dir->inode->cwd_cnt++;
   thread_current ()->curr_dir = new_dir;
+  lock_release (&fd_lock);
 
-  unlock_fs ();
+  dir_close (old_dir);
 
   return true;
 }
@@ -86,8 +87,16 @@ remove_file_or_dir(const char *path)
          with a file descriptor or a cwd of any process 
          (it's enough to check that there are zero openers) */
         struct dir *dir = dir_open (dir_path_lookup (path));
-        if (dir_is_empty (dir) && !is_dir_open_fd_global (dir) && !is_dir_cwd_global (dir))
+        bool in_use;
+
+        if (dir == NULL)
+          return false;
+        lock_acquire (&fd_lock);
+        in_use = is_dir_open_fd_global (dir) || is_dir_cwd_global (dir);
+        lock_release (&fd_lock);
+        if (!in_use && dir_is_empty (dir))
           result = filesys_remove (path);
+        dir_close (dir);
       }
       else
       {
@@ -98,20 +107,30 @@ remove_file_or_dir(const char *path)
   return result;
 }
 
+/* Returns the descriptor FD_NUM of the current thread, or NULL.
+   Only its owner frees a descriptor, so the result stays valid after
+   fd_lock is released. */
 struct file_descriptor *
 get_file_descriptor (int fd_num)
 {
+  struct file_descriptor *result = NULL;
   struct list_elem *e;
+
+  lock_acquire (&fd_lock);
   e = list_tail (&open_files);
   while ((e = list_prev (e)) != list_head (&open_files)) 
     {
       struct file_descriptor *fd;
       fd = list_entry (e, struct file_descriptor, elem);
       if (fd->fd_num == fd_num && fd->owner == thread_current()->tid)
-          return fd;
+        {
+          result = fd;
+          break;
+        }
     }
+  lock_release (&fd_lock);
 
-  return NULL;
+  return result;
 }
 
 /* Open directory with file descriptor */
@@ -122,7 +141,6 @@ open_file_or_dir(const char *path)
   struct file_descriptor *fd = malloc(sizeof(struct file_descriptor));
   struct dir *dir = (void *)0x1;
   struct file *f = (void *)0x1;
-  lock_fs ();
 
   bool is_dir = path_is_dir (path);
   if (is_dir)
@@ -130,9 +148,12 @@ open_file_or_dir(const char *path)
   else
     f = filesys_open (path);
 
-  if(f == NULL || dir == NULL)
+  if(f == NULL || dir == NULL || fd == NULL)
   {
-    unlock_fs ();
+    if (is_dir)
+      dir_close (dir);
+    else
+      file_close (f);
     if(fd != NULL)
       free(fd);
 
@@ -140,6 +161,7 @@ open_file_or_dir(const char *path)
   }
   else
   {
+    lock_acquire (&fd_lock);
     if (is_dir)
     {
       fd->open_file = NULL;
@@ -157,8 +179,8 @@ open_file_or_dir(const char *path)
     fd->is_dir = is_dir;
     list_push_front (&open_files, &fd->elem);
     fd_count ++;
+    lock_release (&fd_lock);
 
-    unlock_fs ();
     return fd->fd_num;
   }
 }
@@ -167,11 +189,9 @@ int filelength_open_file (int fd_num)
 {
   int result = -1;
 
-  lock_fs ();
   struct file_descriptor *fd = get_file_descriptor (fd_num);
   if (fd != NULL)
     result = file_length (fd->open_file);
-  unlock_fs ();
 
   return result;
 }
@@ -187,7 +207,6 @@ read_open_file (int fd_num, void *buffer, unsigned length)
       char * end = start + length;
       char c;
 
-      lock_fs ();
       while(start < end && (c = input_getc()) != 0)
       {
         
@@ -195,7 +214,6 @@ read_open_file (int fd_num, void *buffer, unsigned length)
         start++;
         result++;
       }
-      unlock_fs (); 
 
       *start = 0;
     }
@@ -203,16 +221,12 @@ read_open_file (int fd_num, void *buffer, unsigned length)
     result = -1;
   else //it is an actual file descriptor
     {
-      lock_fs (); 
       struct file_descriptor *fd = get_file_descriptor (fd_num);
-      unlock_fs (); 
 
-      FS_IN;
       if (fd != NULL && !fd->is_dir)
         result = file_read (fd->open_file, buffer, length);
       else
         result = -1;
-      FS_OUT;
     }
 
   return result;
@@ -231,37 +245,41 @@ write_open_file (int fd_num, void *buffer, unsigned length)
       result = -1;
   else if (fd_num == STDOUT_FILENO)
     {
-      lock_fs (); 
       putbuf (buffer, length); //#TODO check for too long buffers, break them down.
-      unlock_fs (); 
     }
   else //it is an actual file descriptor
     {
-      lock_fs (); 
       struct file_descriptor *fd = get_file_descriptor (fd_num);
-      unlock_fs ();
 
-      FS_IN;
       if (fd != NULL && !fd->is_dir)
         result = file_write (fd->open_file, buffer, length);
       else
         result = -1;
-      FS_OUT;
     }
 
   return result;
 }
 
+/* Reserves space for the first SIZE bytes of the file open as
+   FD_NUM, see file_allocate(). */
+bool
+allocate_open_file (int fd_num, unsigned size, bool keep_size)
+{
+  struct file_descriptor *fd = get_file_descriptor (fd_num);
+
+  if (fd == NULL || fd->is_dir || (off_t) size < 0)
+    return false;
+  return file_allocate (fd->open_file, size, keep_size);
+}
+
 /* Sets the current position in FILE to NEW_POS bytes from the
    start of the file. */  
 void
 seek_open_file (int fd_num, unsigned position)
 {
-  lock_fs (); 
   struct file_descriptor *fd = get_file_descriptor (fd_num);
   if (fd != NULL)
     file_seek (fd->open_file, position);
-  unlock_fs ();
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -272,11 +290,9 @@ tell_open_file (int fd_num)
 {
   int result = 0;
 
-  lock_fs ();
   struct file_descriptor *fd = get_file_descriptor (fd_num);
   if (fd != NULL)
     result = file_tell (fd->open_file);
-  unlock_fs ();
 
   return result;
 }
@@ -294,9 +310,7 @@ memory_map_file (int fd_num, void *start_page)
   struct file *f = fd->open_file;
   ASSERT (f != NULL);
 
-  lock_fs ();
   struct file *rf = file_reopen(f);
-  unlock_fs ();
 
   int map_id = pt_suppl_handle_mmap (rf, start_page);
   return map_id;
@@ -311,56 +325,58 @@ memory_unmap_file (int map_id)
   lock_release (&current->pt_suppl_lock);
 }
 
+/* Takes FD, owned by the current thread, out of the table and
+   closes what it refers to. */
+static void
+close_file_descriptor (struct file_descriptor *fd)
+{
+  lock_acquire (&fd_lock);
+  list_remove (&fd->elem);
+  if (fd->is_dir)
+    fd->open_dir->inode->open_fd_cnt--;
+  lock_release (&fd_lock);
+
+  if (!fd->is_dir)
+    file_close(fd->open_file);
+  free(fd);
+}
+
 void
 close_open_file_or_dir (int fd_num)
 {
-  lock_fs (); 
   struct file_descriptor *fd = get_file_descriptor (fd_num);
   if (fd != NULL && fd->owner == thread_current ()->tid)
-  {
-    if (fd->is_dir)
-    {
-      fd->open_dir->inode->open_fd_cnt--;
-    }
-    else
-    {
-      file_close(fd->open_file);
-    }
-    
-    list_remove (&fd->elem);      
-    free(fd);
-  }
-  unlock_fs ();
+    close_file_descriptor (fd);
 }
 
 void 
 close_all_files_and_dir ()
 {
-  lock_fs ();
+  struct file_descriptor *fd;
 
-  struct list_elem *e;
-  e = list_tail (&open_files);
-  while ((e = list_prev (e)) != list_head (&open_files)) 
+  do
     {
-      struct file_descriptor *fd;
-      fd = list_entry (e, struct file_descriptor, elem);
-      if (fd->owner == thread_current ()->tid)
+      struct list_elem *e;
+
+      fd = NULL;
+      lock_acquire (&fd_lock);
+      for (e = list_begin (&open_files); e != list_end (&open_files);
+           e = list_next (e))
         {
-          if (fd->is_dir)
-          {
-            fd->open_dir->inode->open_fd_cnt--;
-          }
-          else
-          {
-            file_close(fd->open_file);
-          }
-          e = list_next(e);
-          list_remove (&fd->elem);      
-          free(fd);
+          struct file_descriptor *f;
+          f = list_entry (e, struct file_descriptor, elem);
+          if (f->owner == thread_current ()->tid)
+            {
+              fd = f;
+              break;
+            }
         }
-    }
+      lock_release (&fd_lock);
 
-  unlock_fs ();
+      if (fd != NULL)
+        close_file_descriptor (fd);
+    }
+  while (fd != NULL);
 
   unmap_all();
 }
@@ -416,13 +432,3 @@ is_dir_cwd_global (struct dir *dir)
   ASSERT (dir != NULL);
   return (dir->inode->cwd_cnt > 0);
 }
-
-void lock_fs ()
-{
-  lock_acquire (&files_lock);
-}
-
-void unlock_fs()
-{
-  lock_release (&files_lock);
-}
\ No newline at end of file
@@ -4,12 +4,6 @@
 #include "filesys/file.h"
 #include "lib/string.h"
 
-#define FS_DEBUG //TODO comment to enable fine-grained synch on W/R
-
-/* Synchronizes accesses to file system */
-struct lock files_lock;
-
-
 unsigned int fd_count;
 
 /* Represents an open file. */
@@ -25,14 +19,6 @@ struct file_descriptor
 };
 
 
-#ifdef FS_DEBUG
-#define FS_IN lock_fs();
-#define FS_OUT unlock_fs();
-#else
-#define FS_IN 
-#define FS_OUT
-#endif
-
 void fsaccess_init (void);
 
 bool create_file(const char *file, unsigned length);
@@ -45,6 +31,7 @@ int open_file_or_dir(const char *filename);
 int filelength_open_file (int fd_num);
 int read_open_file(int fd_num, void *buffer, unsigned length);
 int write_open_file (int fd_num, void *buffer, unsigned length);
+bool allocate_open_file (int fd_num, unsigned size, bool keep_size);
 void seek_open_file (int fd_num, unsigned position);
 unsigned tell_open_file (int fd_num);
 int memory_map_file (int fd_num, void *start_page);
@@ -56,7 +43,4 @@ bool is_directory (int fd);
 int fd_inode_number (int fd);
 bool is_dir_open_fd_global (struct dir *dir);
 bool is_dir_cwd_global (struct dir *dir);
-
-void lock_fs (void);
-void unlock_fs(void);
 #endif
\ No newline at end of file
@@ -8,35 +8,70 @@
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
 #include "threads/malloc.h"
-
-//allocate block sector or normal sector
-#define CHECK_ALLOCATE_AND_GET_SECTOR(table, idx, is_index_block)\
-({\
-    if (allocate_new && table[idx] == SECTOR_ERROR)\
-      {\
-        if (is_index_block)\
-          allocated_sector = allocate_new_index_inode (table, idx);\
-        else\
-          allocated_sector = allocate_new_block (table, idx);\
-        if (allocated_sector == SECTOR_ERROR)\
-          return SECTOR_ERROR;\
-      }\
-    block_sector_t ret = table[idx];\
-    if (!allocate_new && ret == SECTOR_ERROR)\
-      return SECTOR_ERROR;\
-    ret;\
-})
+#include "threads/vaddr.h"
+
+/* A region of the main index: COUNT entries starting at FIRST, each
+   the root of a tree of index blocks DEPTH levels deep. */
+struct index_region
+  {
+    size_t first;
+    size_t count;
+    int depth;
+  };
+
+static const struct index_region index_regions[] =
+  {
+    { 0, DIRECT_BLOCKS, 0 },
+    { DIRECT_BLOCKS, INDIRECT_BLOCKS, 1 },
+    { DIRECT_BLOCKS + INDIRECT_BLOCKS, D_INDIRECT_BLOCKS, 2 },
+    { DIRECT_BLOCKS + INDIRECT_BLOCKS + D_INDIRECT_BLOCKS, T_INDIRECT_BLOCKS, 3 },
+    { DIRECT_BLOCKS + INDIRECT_BLOCKS + D_INDIRECT_BLOCKS + T_INDIRECT_BLOCKS,
+      Q_INDIRECT_BLOCKS, INDEX_MAX_DEPTH },
+  };
+
+static block_sector_t index_walk (struct inode *inode, off_t pos,
+                                  bool allocate_new, block_sector_t data);
+static block_sector_t index_block_entry (block_sector_t sector, size_t idx,
+                                         bool is_index_block,
+                                         bool allocate_new,
+                                         block_sector_t data,
+                                         block_sector_t hint);
+static bool inode_pin_index (struct inode *inode, block_sector_t sector);
+static block_sector_t index_entry (block_sector_t *table, size_t idx,
+                                   bool is_index_block, bool allocate_new,
+                                   block_sector_t data, block_sector_t hint);
+static void inode_free_index (const block_sector_t *table, size_t cnt,
+                              int depth);
 
 static void inode_release_disk (struct inode *inode);
 static void inode_load_disk (struct inode *inode);
-
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-sectors_to_bytes (block_sector_t size)
-{
-  return size*BLOCK_SECTOR_SIZE;
-}
+static bool inode_pin_sector (struct inode *inode, block_sector_t sector, off_t ofs);
+static void inode_unpin_all (struct inode *inode);
+static off_t inode_read (struct inode *inode, void *buffer_, off_t size,
+                         off_t offset, bool bypass);
+static block_sector_t inode_run_lookup (struct inode *inode, block_sector_t logical);
+static void inode_run_add (struct inode *inode, block_sector_t logical,
+                           block_sector_t physical);
+static void inode_run_invalidate (struct inode *inode);
+static bool inode_grow_extents (struct inode *inode, size_t cnt);
+static size_t inode_contiguous (struct inode *inode, off_t offset,
+                                block_sector_t sector, size_t max_cnt);
+static block_sector_t inode_extent_to_sector (const struct inode_disk *data,
+                                              block_sector_t logical);
+static size_t inode_extent_sectors (const struct inode_disk *data);
+static bool inode_fill_holes (struct inode *inode, size_t cnt);
+static off_t inode_read_inline (struct inode *inode, void *buffer,
+                                off_t size, off_t offset);
+static off_t inode_write_inline (struct inode *inode, const void *buffer,
+                                 off_t size, off_t offset);
+static bool inode_uninline (struct inode *inode);
+static block_sector_t inode_write_sector (struct inode *inode, off_t size,
+                                         off_t offset);
+
+/* Whether new inodes keep their data as extents rather than in index
+   blocks. Chosen when the file system is formatted, and read back
+   from the root directory inode at boot otherwise. */
+static bool use_extents;
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -53,26 +88,149 @@ bytes_to_sectors (off_t size)
    Remember to call this after having loaded the inode in memory.
    */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   block_sector_t sector = SECTOR_ERROR;
 
-  if (pos < inode->data->length)
-    sector = inode_pos_to_real_sector (inode, pos, false);
+  /* A writer adding sectors holds inode_growth exclusive and looks
+     up what it just added */
+  bool growing = rwlock_held_by_current_thread (&inode->inode_growth);
+
+  if (!growing)
+    rwlock_acquire_read (&inode->inode_growth);
+  if (pos < inode->data->length && !(inode->data->flags & INODE_INLINE))
+    {
+      block_sector_t logical = pos / BLOCK_SECTOR_SIZE;
+
+      sector = inode_run_lookup (inode, logical);
+      if (sector == SECTOR_ERROR)
+        {
+          sector = inode_pos_to_real_sector (inode, pos, false);
+          if (sector != SECTOR_ERROR)
+            inode_run_add (inode, logical, sector);
+        }
+    }
+  if (!growing)
+    rwlock_release_read (&inode->inode_growth);
 
   return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the disk sector of data sector LOGICAL of INODE if it is in
+   a known run, SECTOR_ERROR otherwise. */
+static block_sector_t
+inode_run_lookup (struct inode *inode, block_sector_t logical)
+{
+  block_sector_t sector = SECTOR_ERROR;
+
+  lock_acquire (&inode->run_lock);
+  for (size_t i = 0; i < inode->run_cnt; i++)
+    {
+      struct inode_run *r = &inode->runs[i];
+      if (logical >= r->logical && logical - r->logical < r->length)
+        {
+          sector = r->physical + (logical - r->logical);
+          break;
+        }
+    }
+  lock_release (&inode->run_lock);
+
+  return sector;
+}
+
+/* Remembers that data sector LOGICAL of INODE is disk sector
+   PHYSICAL, growing the run it continues if there is one. */
+static void
+inode_run_add (struct inode *inode, block_sector_t logical,
+               block_sector_t physical)
+{
+  struct inode_run *r;
+  size_t i;
+
+  lock_acquire (&inode->run_lock);
+  for (i = 0; i < inode->run_cnt; i++)
+    {
+      r = &inode->runs[i];
+      if (logical == r->logical + r->length
+          && physical == r->physical + r->length)
+        {
+          r->length++;
+          break;
+        }
+      if (logical + 1 == r->logical && physical + 1 == r->physical)
+        {
+          r->logical--;
+          r->physical--;
+          r->length++;
+          break;
+        }
+    }
+
+  if (i == inode->run_cnt)
+    {
+      if (inode->run_cnt < INODE_RUNS)
+        r = &inode->runs[inode->run_cnt++];
+      else
+        {
+          r = &inode->runs[inode->run_next];
+          inode->run_next = (inode->run_next + 1) % INODE_RUNS;
+        }
+      r->logical = logical;
+      r->physical = physical;
+      r->length = 1;
+    }
+  lock_release (&inode->run_lock);
+}
+
+/* Forgets every run of INODE. */
+static void
+inode_run_invalidate (struct inode *inode)
+{
+  lock_acquire (&inode->run_lock);
+  inode->run_cnt = 0;
+  inode->run_next = 0;
+  lock_release (&inode->run_lock);
+}
+
+/* Open inodes by sector, so that opening a single inode twice
+   returns the same `struct inode'. open_inodes_lock protects the
+   table and the open_cnt of every inode in it. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static unsigned open_inode_hash (const struct hash_elem *he, void *aux UNUSED);
+static bool open_inode_less (const struct hash_elem *ha,
+                             const struct hash_elem *hb, void *aux UNUSED);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, open_inode_hash, open_inode_less, NULL);
+  lock_init (&open_inodes_lock);
+}
+
+/* Makes the next file system format keep file data as extents. */
+void
+inode_use_extents (bool enable)
+{
+  use_extents = enable;
+}
+
+/* Picks the layout of new inodes to match the root directory of a
+   file system that was not just formatted. */
+void
+inode_detect_layout (void)
+{
+  struct inode_disk *root = malloc (sizeof *root);
+  if (root == NULL)
+    PANIC ("No memory left");
+
+  bc_block_read (ROOT_DIR_SECTOR, root, 0, BLOCK_SECTOR_SIZE);
+  use_extents = root->magic == INODE_MAGIC
+                && (root->flags & INODE_EXTENT_MAP) != 0;
+  free (root);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -86,7 +244,6 @@ inode_create (block_sector_t sector, off_t length, block_sector_t parent, bool i
   struct inode_disk *disk_inode = NULL;
   struct inode *inode = NULL;
   bool success = true;
-  block_sector_t start_block;
 
   ASSERT (length >= 0);
 
@@ -106,39 +263,66 @@ inode_create (block_sector_t sector, off_t length, block_sector_t parent, bool i
           // Write block for inode
           bc_block_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
         }
+      else if (length <= INODE_INLINE_MAX)
+        {
+          // Small enough to live in the inode: no data sector yet
+          disk_inode->flags = INODE_INLINE;
+          disk_inode->length = length;
+          disk_inode->parent = parent;
+          disk_inode->magic = INODE_MAGIC;
+          bc_block_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+        }
+      else if (use_extents)
+        {
+          // Extents are allocated by inode_grow as the file grows
+          disk_inode->flags = INODE_EXTENT_MAP;
+          disk_inode->extent_cnt = 0;
+          disk_inode->length = 0;
+          disk_inode->parent = parent;
+          disk_inode->magic = INODE_MAGIC;
+          bc_block_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+
+          if (length > 0)
+            {
+              inode = inode_open (sector);
+              if (inode == NULL)
+                success = false;
+              else
+                {
+                  inode_load_disk (inode);
+                  rwlock_acquire_write (&inode->inode_growth);
+                  success = inode_grow (inode, length, 0);
+                  if (!success)
+                    {
+                      // Give back the extents grown before it failed
+                      struct inode_disk *data = inode->data;
+                      for (size_t i = 0; i < data->extent_cnt; i++)
+                        free_map_release (data->index.extents[i].start,
+                                          data->index.extents[i].length);
+                      data->extent_cnt = 0;
+                      data->length = 0;
+                      inode_run_invalidate (inode);
+                      inode->data_dirty = true;
+                    }
+                  rwlock_release_write (&inode->inode_growth);
+                  inode_release_disk (inode);
+                  inode_close (inode);
+                }
+            }
+        }
       else
         {
-          // Nothing is allocated yet: allocate first sector to have a starting position
-          start_block = allocate_new_block (disk_inode->index.main_index, 0);
-          if(start_block == SECTOR_ERROR)
-            return false;
-          disk_inode->start = start_block;
-          // All other blocks are empty
-          for (int i = 1; i < INDEX_MAIN_ENTRIES; i++)
+          // Nothing is allocated: the whole file is a hole until written
+          disk_inode->start = SECTOR_ERROR;
+          for (int i = 0; i < INDEX_MAIN_ENTRIES; i++)
             disk_inode->index.main_index[i] = SECTOR_ERROR;
-
-          // Set length based on the fact that the first block is allocated
-          if (length >= BLOCK_SECTOR_SIZE)
-            disk_inode->length = BLOCK_SECTOR_SIZE;
-          else
-            disk_inode->length = length;
-
+          disk_inode->length = length;
           disk_inode->parent = parent; 
           disk_inode->is_index_block = (uint32_t)is_index_block;
           disk_inode->magic = INODE_MAGIC;
 
           // Write block for inode
           bc_block_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-
-          // If bigger than one block, grow inode to desired initial size (Allocates non-contiguously)
-          if (length > BLOCK_SECTOR_SIZE)
-            {
-              inode = inode_open (sector);
-              inode_load_disk (inode);
-              success = inode_grow (inode, length, 0);
-              inode_release_disk (inode);
-              inode_close (inode);
-            }
         }
       free (disk_inode);
     }
@@ -151,40 +335,54 @@ inode_create (block_sector_t sector, off_t length, block_sector_t parent, bool i
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *he;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  he = hash_find (&open_inodes, &key.elem);
+  if (he != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (he, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->close_cnt = 0;
   inode->open_fd_cnt = 0;
   inode->cwd_cnt = 0;
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init (&inode->inode_lock);
-  lock_init (&inode->inode_growth);
+  rwlock_init (&inode->inode_growth);
+  lock_init (&inode->dir_lock);
   DEBUG_LOCK_ID (&inode->inode_lock, 15043);
   inode->data = NULL; //Lazy loaded
-  inode->access_count = 0;
+  inode->data_dirty = false;
   inode->logical_length = -1;
+  inode->pinned_cnt = 0;
+  lock_init (&inode->pin_lock);
+  inode->run_cnt = 0;
+  inode->run_next = 0;
+  lock_init (&inode->run_lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  inode_pin_sector (inode, sector, -1);
   return inode;
 }
 
@@ -193,7 +391,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -225,63 +427,204 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          inode_load_disk (inode);
-          free_map_release (inode->data->start,
-                            bytes_to_sectors (inode->data->length)); 
-          inode_release_disk (inode);
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  inode->close_cnt++;
+  lock_release (&open_inodes_lock);
+
+  /* This was the last opener. A changed inode is written back
+     without holding open_inodes_lock, which would make every open
+     and close wait for the disk, but while it is still in the table,
+     so that reopening the sector finds it instead of reading it
+     stale. */
+  if (!inode->removed)
+    inode_release_disk (inode);
+
+  /* Keep it if it was reopened meanwhile, and leave it to the last
+     closer if it was reopened and closed again */
+  lock_acquire (&open_inodes_lock);
+  if (--inode->close_cnt > 0 || inode->open_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Sectors are unpinned before they can be freed below */
+  inode_unpin_all (inode);
+
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      inode_load_disk (inode);
+      free_map_release (inode->sector, 1);
+      if (inode->data->flags & INODE_INLINE)
+        ;
+      else if (inode->data->flags & INODE_EXTENT_MAP)
+        for (size_t i = 0; i < inode->data->extent_cnt; i++)
+          free_map_release (inode->data->index.extents[i].start,
+                            inode->data->index.extents[i].length);
+      else
+        for (size_t i = 0; i < sizeof index_regions / sizeof *index_regions; i++)
+          inode_free_index (inode->data->index.main_index + index_regions[i].first,
+                            index_regions[i].count, index_regions[i].depth);
     }
+
+  free (inode->data);
+  free (inode); 
 }
 
+/* Reads the on-disk inode of INODE into memory the first time it is
+   needed. It then stays there until INODE is closed by its last
+   opener; whoever changes it sets data_dirty. */
 void
 inode_load_disk (struct inode *inode)
 {
+  if (inode->data != NULL) //only ever set once
+    return;
+
+  struct inode_disk *data = NULL;
+
   lock_acquire (&inode->inode_lock);
-  ASSERT (inode->access_count != 0 || inode->data == NULL);
-  if (inode->access_count == 0) //Don't re-load
+  if (inode->data == NULL)
     {
-      ASSERT (inode->data == NULL);
-      inode->data = malloc (sizeof (struct inode_disk));
-      if (inode->data == NULL) 
+      data = malloc (sizeof (struct inode_disk));
+      if (data == NULL) 
         PANIC ("No memory left");
-      bc_block_read (inode->sector, inode->data, 0, BLOCK_SECTOR_SIZE);
+      bc_block_read (inode->sector, data, 0, BLOCK_SECTOR_SIZE);
 
       if(inode->logical_length == -1)
-        inode->logical_length = inode->data->length;
+        inode->logical_length = data->length;
+      inode->data = data;
     }
-
-  inode->access_count ++;
   lock_release (&inode->inode_lock);
+
+  /* Every lookup through an index block starts at the top-level one,
+     so those stay in the cache while the inode is open. A removed
+     inode is only loaded to be freed. */
+  if (data != NULL && !inode->removed && !data->is_index_block
+      && !(data->flags & (INODE_INLINE | INODE_EXTENT_MAP)))
+    for (size_t i = 0; i < sizeof index_regions / sizeof *index_regions; i++)
+      {
+        const struct index_region *r = &index_regions[i];
+
+        for (size_t j = 0; r->depth > 0 && j < r->count; j++)
+          if (data->index.main_index[r->first + j] != SECTOR_ERROR
+              && !inode_pin_index (inode, data->index.main_index[r->first + j]))
+            return;
+      }
 }
 
+/* Writes the in-memory inode back to the buffer cache if it was
+   changed since it was last written, once an operation on INODE is
+   done with it. */
 void 
 inode_release_disk (struct inode *inode)
 {
+  if (!inode->data_dirty)
+    return;
+
   lock_acquire (&inode->inode_lock);
-  ASSERT (inode->access_count > 0);
-  ASSERT (inode->access_count != 0 || inode->data == NULL);
-  inode->access_count --; 
-  if (inode->access_count == 0)
+  if (inode->data_dirty)
     {
+      inode->data_dirty = false;
       bc_block_write (inode->sector, inode->data, 0, BLOCK_SECTOR_SIZE);
-      free(inode->data);
-      inode->data = NULL;
     }
   lock_release (&inode->inode_lock);
 }
 
+/* Pins the sector holding byte OFFSET of INODE's data in the buffer
+   cache until INODE is closed by its last opener. Returns false if
+   there is no such sector or it could not be pinned. */
+bool
+inode_pin (struct inode *inode, off_t offset)
+{
+  block_sector_t sector;
+  size_t i;
+
+  offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+  lock_acquire (&inode->pin_lock);
+  for (i = 0; i < inode->pinned_cnt; i++)
+    if (inode->pinned_ofs[i] == offset)
+      break;
+  lock_release (&inode->pin_lock);
+  if (i < inode->pinned_cnt)
+    return true;
+
+  inode_load_disk (inode);
+  sector = byte_to_sector (inode, offset);
+  inode_release_disk (inode);
+  if (sector == SECTOR_ERROR)
+    return false;
+
+  return inode_pin_sector (inode, sector, offset);
+}
+
+/* Pins SECTOR, which holds metadata of INODE (OFS is -1) or its data
+   at byte OFS, for as long as INODE stays open. Returns true if the
+   sector is pinned on behalf of INODE, false if INODE_PINNED_MAX
+   sectors already are or the cache's pinning budget is used up. */
+static bool
+inode_pin_sector (struct inode *inode, block_sector_t sector, off_t ofs)
+{
+  bool pinned = true;
+  size_t i;
+
+  lock_acquire (&inode->pin_lock);
+  for (i = 0; i < inode->pinned_cnt; i++)
+    if (inode->pinned[i] == sector)
+      break;
+  if (i == inode->pinned_cnt)
+    {
+      pinned = i < INODE_PINNED_MAX && bc_pin (sector);
+      if (pinned)
+        {
+          inode->pinned[i] = sector;
+          inode->pinned_ofs[i] = ofs;
+          inode->pinned_cnt++;
+        }
+    }
+  lock_release (&inode->pin_lock);
+
+  return pinned;
+}
+
+/* Pins SECTOR, a top-level index block of INODE, unless
+   INODE_PINNED_INDEX of them are pinned already, so that the rest
+   of the pins are left for data. Returns false if there were. */
+static bool
+inode_pin_index (struct inode *inode, block_sector_t sector)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&inode->pin_lock);
+  for (i = 0; i < inode->pinned_cnt; i++)
+    if (inode->pinned[i] != inode->sector && inode->pinned_ofs[i] == -1)
+      cnt++;
+  lock_release (&inode->pin_lock);
+
+  if (cnt >= INODE_PINNED_INDEX)
+    return false;
+  inode_pin_sector (inode, sector, -1);
+  return true;
+}
+
+/* Releases every sector pinned on behalf of INODE. */
+static void
+inode_unpin_all (struct inode *inode)
+{
+  lock_acquire (&inode->pin_lock);
+  while (inode->pinned_cnt > 0)
+    bc_unpin (inode->pinned[--inode->pinned_cnt]);
+  lock_release (&inode->pin_lock);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -296,12 +639,42 @@ inode_remove (struct inode *inode) //TODO maybe also remove all inodes pointed b
    than SIZE if an error occurs or end of file is reached. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+{
+  return inode_read (inode, buffer_, size, offset, false);
+}
+
+/* Like inode_read_at(), but for reading into PAGE, a frame that will
+   hold its own copy of the data (a page of a mapped file or of an
+   executable). Whole sectors are read around the buffer cache, so
+   the page is not cached twice. */
+off_t
+inode_read_page (struct inode *inode, void *page, off_t size, off_t offset)
+{
+  ASSERT (size <= PGSIZE);
+  return inode_read (inode, page, size, offset, true);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, bypassing the buffer cache for whole sectors if BYPASS. */
+static off_t
+inode_read (struct inode *inode, void *buffer_, off_t size, off_t offset,
+            bool bypass)
 {
   if (inode->logical_length == 0)
     return 0;
 
   inode_load_disk (inode);
 
+  if (inode->data->flags & INODE_INLINE)
+    {
+      off_t bytes_read = inode_read_inline (inode, buffer_, size, offset);
+      if (bytes_read >= 0)
+        {
+          inode_release_disk (inode);
+          return bytes_read;
+        }
+    }
+
   uint8_t *buffer = (uint8_t *)buffer_;
   off_t bytes_read = 0;
 
@@ -309,8 +682,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
     {
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if (sector_idx == SECTOR_ERROR)
-        break;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
@@ -323,8 +694,26 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      bc_block_read (sector_idx, buffer + bytes_read, 
-                     sector_ofs, chunk_size);
+      /* A sector never written is a hole and reads as zeros */
+      if (sector_idx == SECTOR_ERROR)
+        memset (buffer + bytes_read, 0, chunk_size);
+      /* Whole sectors that follow each other on disk go to the
+         device as a single request */
+      else if (chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          off_t left = size < inode_left ? size : inode_left;
+          size_t cnt = inode_contiguous (inode, offset, sector_idx,
+                                         left / BLOCK_SECTOR_SIZE);
+
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
+          if (bypass)
+            bc_block_read_bypass (sector_idx, cnt, buffer + bytes_read);
+          else
+            bc_block_read_multi (sector_idx, cnt, buffer + bytes_read);
+        }
+      else
+        bc_block_read (sector_idx, buffer + bytes_read, 
+                       sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
@@ -336,6 +725,50 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Returns how many of the MAX_CNT sectors of INODE starting at
+   OFFSET, which is held in disk sector SECTOR, follow each other on
+   disk, at least 1 and at most BC_RUN_MAX. */
+static size_t
+inode_contiguous (struct inode *inode, off_t offset, block_sector_t sector,
+                  size_t max_cnt)
+{
+  size_t cnt = 1;
+
+  if (max_cnt > BC_RUN_MAX)
+    max_cnt = BC_RUN_MAX;
+  while (cnt < max_cnt
+         && byte_to_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE)
+            == sector + cnt)
+    cnt++;
+  return cnt;
+}
+
+/* Asks the buffer cache to prefetch the sectors holding SIZE bytes
+   of INODE starting at OFFSET, at most RA_MAX_WINDOW of them. Stops at
+   end of file; returns without waiting for the reads. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  block_sector_t sectors[RA_MAX_WINDOW];
+  size_t cnt = 0;
+  off_t end = offset + size;
+
+  inode_load_disk (inode);
+  if (end > inode->logical_length)
+    end = inode->logical_length;
+
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+       offset < end && cnt < RA_MAX_WINDOW; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx != SECTOR_ERROR)
+        sectors[cnt++] = sector_idx;
+    }
+  inode_release_disk (inode);
+
+  bc_request_read_ahead (sectors, cnt);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs. */
@@ -345,6 +778,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   inode_load_disk (inode);
 
+  if (inode->data->flags & INODE_INLINE)
+    {
+      off_t bytes_written = inode_write_inline (inode, buffer_, size, offset);
+      if (bytes_written >= 0)
+        {
+          inode_release_disk (inode);
+          return bytes_written;
+        }
+    }
+
   uint8_t *buffer = (uint8_t *)buffer_;
   off_t bytes_written = 0;
 
@@ -357,17 +800,20 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      if (sector_idx == SECTOR_ERROR) // Read past end of inode
+      if (sector_idx == SECTOR_ERROR) // Hole, or past end of inode
         {
-          lock_acquire (&inode->inode_lock);
-          is_growing = inode_grow (inode, size, offset);
-
-          if (!is_growing)
-          {
-            lock_release (&inode->inode_lock);
-            break;
-          }
+          rwlock_acquire_write (&inode->inode_growth);
+          is_growing = true;
+
+          /* Another writer may have filled it meanwhile */
           sector_idx = byte_to_sector (inode, offset);
+          if (sector_idx == SECTOR_ERROR)
+            sector_idx = inode_write_sector (inode, size, offset);
+          if (sector_idx == SECTOR_ERROR)
+            {
+              rwlock_release_write (&inode->inode_growth);
+              break;
+            }
         }
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -382,7 +828,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         if (is_growing)
         {
           inode->logical_length = inode->data->length;
-          lock_release (&inode->inode_lock);
+          rwlock_release_write (&inode->inode_growth);
         }
         break;
       }
@@ -393,7 +839,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (is_growing)
       {
         inode->logical_length = inode->data->length;
-        lock_release (&inode->inode_lock);
+        rwlock_release_write (&inode->inode_growth);
       }
 
       /* Advance. */
@@ -403,7 +849,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
 
   ASSERT (!lock_held_by_current_thread (&inode->inode_lock));
-  ASSERT (!lock_held_by_current_thread (&inode->inode_growth)); 
+  ASSERT (!rwlock_held_by_current_thread (&inode->inode_growth)); 
 
   inode_release_disk (inode);
   return bytes_written;
@@ -441,132 +887,535 @@ inode_length (struct inode *inode)
   return r;
 }
 
-// Assumes that the starting sector is already allocated
-// Assumes that the byte "inode->data->length" is in the last sector of the inode;
+/* Returns true if INODE is a directory that keeps its entries in a
+   hash table, see filesys/directory.c. */
+bool
+inode_is_hashed_dir (struct inode *inode)
+{
+  inode_load_disk (inode);
+  bool hashed = (inode->data->flags & INODE_HASHED_DIR) != 0;
+  inode_release_disk (inode);
+  return hashed;
+}
+
+/* Records that the directory INODE now keeps its entries in a hash
+   table. */
+void
+inode_set_hashed_dir (struct inode *inode)
+{
+  inode_load_disk (inode);
+  rwlock_acquire_write (&inode->inode_growth);
+  inode->data->flags |= INODE_HASHED_DIR;
+  inode->data_dirty = true;
+  rwlock_release_write (&inode->inode_growth);
+  inode_release_disk (inode);
+}
+
+/* Makes INODE at least OFFSET + SIZE bytes long. Extent mapped
+   inodes get zeroed sectors up to the new end; index mapped inodes
+   only record the new length, what lies past the old end is a hole
+   until it is written.
+   Call with inode_growth held exclusive. */
 bool inode_grow (struct inode *inode, off_t size, off_t offset)
 {
   ASSERT (size > 0);
-  block_sector_t sector_inode_relative;
-
-  if (offset + size > round_up_to_sector_boundary (inode->data->length))
-    { // Actually allocate more sectors
-      block_sector_t last_sector;  
-      off_t grow_len_bytes;
-      size_t grow_len;
-      if (inode->data->length <= BLOCK_SECTOR_SIZE)
-        last_sector = inode->data->start;
-      else
-        last_sector = inode->data->start + bytes_to_sectors (inode->data->length) - 1;
-      grow_len_bytes = offset + size - round_up_to_sector_boundary (inode->data->length);
-      grow_len = bytes_to_sectors (grow_len_bytes);
-      ASSERT (grow_len > 0);
+  ASSERT (rwlock_held_by_current_thread (&inode->inode_growth));
+  ASSERT (!(inode->data->flags & INODE_INLINE));
 
-      for (size_t i = 1; i <= grow_len; i++)
-      {
-        sector_inode_relative = last_sector + i - inode->data->start;
-        if(inode_pos_to_real_sector (inode, sectors_to_bytes (sector_inode_relative), true) == SECTOR_ERROR)
-          return false;
-      }
+  if (inode->data->flags & INODE_EXTENT_MAP)
+    {
+      size_t have = inode_extent_sectors (inode->data);
+      size_t want = bytes_to_sectors (offset + size);
 
-      inode->data->length = inode->data->length + grow_len_bytes;
+      inode_run_invalidate (inode);
+      if (want > have && !inode_grow_extents (inode, want - have))
+        return false;
     }
-  else
-    { // Just grow inode length value
-      inode->data->length = offset + size; 
+
+  if (offset + size > inode->data->length)
+    {
+      inode->data->length = offset + size;
+      inode->data_dirty = true;
+    }
+  return true;
+}
+
+/* Returns the sector to hold byte OFFSET of INODE for a write of SIZE
+   bytes there, which is past its end or in a hole. An index mapped
+   inode gets just that sector and grows by the part of the write that
+   falls in it; an extent mapped inode cannot have holes and grows by
+   the whole write. Returns SECTOR_ERROR if the disk is full.
+   Call with inode_growth held exclusive. */
+static block_sector_t
+inode_write_sector (struct inode *inode, off_t size, off_t offset)
+{
+  block_sector_t sector;
+  off_t end;
+
+  if (inode->data->flags & INODE_EXTENT_MAP)
+    {
+      if (!inode_grow (inode, size, offset))
+        return SECTOR_ERROR;
+      return byte_to_sector (inode, offset);
+    }
+
+  sector = inode_pos_to_real_sector (inode, offset, true);
+  if (sector == SECTOR_ERROR)
+    return SECTOR_ERROR;
+  inode->data_dirty = true;
+
+  end = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE) + BLOCK_SECTOR_SIZE;
+  if (end > offset + size)
+    end = offset + size;
+  if (end > inode->data->length)
+    inode_grow (inode, end - offset, offset);
+  return sector;
+}
+
+/* Appends CNT zeroed sectors to the extents of INODE. The last
+   extent is extended in place as far as the free map allows, then new
+   extents are allocated as long as possible, halving the request
+   until it fits. Returns false if the disk or the extent table is
+   full. */
+static bool
+inode_grow_extents (struct inode *inode, size_t cnt)
+{
+  struct inode_disk *data = inode->data;
+
+  while (cnt > 0)
+    {
+      struct inode_extent *e = NULL;
+      block_sector_t start = inode->sector;
+      size_t got = 0;
+
+      if (data->extent_cnt > 0)
+        {
+          e = &data->index.extents[data->extent_cnt - 1];
+          start = e->start + e->length;
+          got = free_map_allocate_at (start, cnt);
+        }
+      if (got == 0)
+        {
+          if (data->extent_cnt == INODE_EXTENTS)
+            return false;
+          for (got = cnt; got > 0; got /= 2)
+            if (free_map_allocate_near (start, got, &start))
+              break;
+          if (got == 0)
+            return false;
+
+          e = &data->index.extents[data->extent_cnt++];
+          e->start = start;
+          e->length = 0;
+          if (data->extent_cnt == 1)
+            data->start = start;
+        }
+
+      bc_block_zero (start, got);
+      e->length += got;
+      cnt -= got;
+      inode->data_dirty = true;
     }
 
   return true;
 }
 
-/* Returns SECTOR_ERROR if the sector needs to be allocated */
-block_sector_t inode_pos_to_real_sector (const struct inode *inode, off_t pos, bool allocate_new)
+/* Returns the disk sector holding data sector LOGICAL of the extent
+   mapped inode DATA, or SECTOR_ERROR past its last extent. */
+static block_sector_t
+inode_extent_to_sector (const struct inode_disk *data, block_sector_t logical)
 {
-  ASSERT (inode != NULL);
-  ASSERT (pos >= 0);
-  block_sector_t sector = SECTOR_ERROR;
-  struct inode *index_inode, *d_index_inode;
-  block_sector_t main_idx, inner_idx, d_inner_idx, offset_mult_64, offset_mult_4096, start, allocated_sector;
+  for (size_t i = 0; i < data->extent_cnt; i++)
+    {
+      const struct inode_extent *e = &data->index.extents[i];
+      if (logical < e->length)
+        return e->start + logical;
+      logical -= e->length;
+    }
+  return SECTOR_ERROR;
+}
 
-  block_sector_t sector_inode_relative = pos / BLOCK_SECTOR_SIZE;
+/* Returns the number of sectors allocated to the extent mapped inode
+   DATA, which may be more than its length if space was reserved. */
+static size_t
+inode_extent_sectors (const struct inode_disk *data)
+{
+  size_t cnt = 0;
+
+  for (size_t i = 0; i < data->extent_cnt; i++)
+    cnt += data->index.extents[i].length;
+  return cnt;
+}
+
+/* Allocates the sectors holding the first SIZE bytes of INODE that
+   are not yet, so that writing there allocates nothing, and makes
+   INODE SIZE bytes long unless KEEP_SIZE, in which case the reserved
+   sectors stay past its end until written. Returns false if writes
+   to INODE are denied or the disk is full; the space reserved up to
+   then stays allocated to INODE. */
+bool
+inode_allocate (struct inode *inode, off_t size, bool keep_size)
+{
+  struct inode_disk *data;
+  bool success = true;
+
+  ASSERT (size >= 0);
+
+  inode_load_disk (inode);
+  data = inode->data;
+  rwlock_acquire_write (&inode->inode_growth);
+
+  if (inode->deny_write_cnt != 0)
+    success = false;
+  else if ((data->flags & INODE_INLINE) && size > INODE_INLINE_MAX)
+    success = inode_uninline (inode);
 
-  if (sector_inode_relative <= INODE_ACCESS_DIRECT)
-    { /* Normal lookup */
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (inode->data->index.main_index, sector_inode_relative, false);
+  if (success && !(data->flags & INODE_INLINE) && size > 0)
+    {
+      size_t want = bytes_to_sectors (size);
+
+      if (data->flags & INODE_EXTENT_MAP)
+        {
+          size_t have = inode_extent_sectors (data);
+
+          inode_run_invalidate (inode);
+          if (want > have)
+            success = inode_grow_extents (inode, want - have);
+        }
+      else
+        {
+          size_t holes = 0;
+
+          for (size_t i = 0; i < want; i++)
+            if (index_walk (inode, i * BLOCK_SECTOR_SIZE, false,
+                            SECTOR_ERROR) == SECTOR_ERROR)
+              holes++;
+          success = inode_fill_holes (inode, holes);
+        }
     }
-  else if (INODE_ACCESS_DIRECT + 1 <= sector_inode_relative && 
-          sector_inode_relative <= INODE_ACCESS_INDIRECT)
-    { /* Lookup in indirect tables */
-      // Normalize to [INODE_ACCESS_DIRECT+1 .. INODE_ACCESS_INDIRECT]
-      main_idx = DIV_ROUND_UP (sector_inode_relative - INODE_ACCESS_DIRECT, INDEX_BLOCK_ENTRIES) + INODE_ACCESS_DIRECT;
 
-      //Find index inode sector
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (inode->data->index.main_index, main_idx, true); 
+  if (success && !keep_size && size > data->length)
+    {
+      data->length = size;
+      inode->logical_length = size;
+      inode->data_dirty = true;
+    }
 
-      index_inode = inode_open (sector);
-      ASSERT (index_inode != NULL);
-      inode_load_disk (index_inode);
-      ASSERT (index_inode->data->is_index_block);
+  rwlock_release_write (&inode->inode_growth);
+  inode_release_disk (inode);
+  return success;
+}
+
+/* Allocates the first CNT holes of the index mapped INODE, taking
+   runs of consecutive sectors from the free map as long as it has
+   them, so that the data ends up on disk in as few pieces as
+   possible. Returns false if the disk is full. Call with
+   inode_growth held exclusive. */
+static bool
+inode_fill_holes (struct inode *inode, size_t cnt)
+{
+  size_t logical = 0;
+  block_sector_t hint = inode->sector;
 
-      start = DIRECT_BLOCKS;
-      offset_mult_64 = (start + (INDEX_BLOCK_ENTRIES * (main_idx - start)));
-      // [0..63]
-      inner_idx = sector_inode_relative - offset_mult_64;
+  while (cnt > 0)
+    {
+      block_sector_t start;
+      size_t got;
+
+      for (got = cnt; got > 0; got /= 2)
+        if (free_map_allocate_near (hint, got, &start))
+          break;
+      if (got == 0)
+        return false;
+      bc_block_zero (start, got);
 
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (index_inode->data->index.block_index, inner_idx, false);
+      for (size_t i = 0; i < got; logical++)
+        {
+          off_t pos = logical * BLOCK_SECTOR_SIZE;
 
-      inode_release_disk (index_inode);
+          if (index_walk (inode, pos, false, SECTOR_ERROR) != SECTOR_ERROR)
+            continue;
+          if (index_walk (inode, pos, true, start + i) == SECTOR_ERROR)
+            {
+              free_map_release (start + i, got - i);
+              return false;
+            }
+          i++;
+        }
+      cnt -= got;
+      hint = start + got;
+      inode->data_dirty = true;
     }
-  else if (INODE_ACCESS_INDIRECT+1 <= sector_inode_relative &&
-          sector_inode_relative <= INODE_ACCESS_MAX)
-    { /* Lookup in doubly indirect tables */
-      // Normalize to [INODE_ACCESS_INDIRECT+1 .. INODE_ACCESS_MAX]
-      main_idx = DIV_ROUND_UP (sector_inode_relative - INODE_ACCESS_INDIRECT, INDEX_BLOCK_ENTRIES*INDEX_BLOCK_ENTRIES) + INODE_ACCESS_INDIRECT;
 
-      //Find index inode sector
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (inode->data->index.main_index, main_idx, true);
+  return true;
+}
 
-      index_inode = inode_open (sector);
-      ASSERT (index_inode != NULL);
-      inode_load_disk (index_inode);
-      ASSERT (index_inode->data->is_index_block);
+/* Reads SIZE bytes of the data stored in INODE itself, starting at
+   OFFSET, into BUFFER. Returns the number of bytes read, or -1 if
+   INODE no longer keeps its data inline. The bytes are copied out
+   through a bounce buffer, so that a page fault on BUFFER is not
+   taken with inode_growth held. */
+static off_t
+inode_read_inline (struct inode *inode, void *buffer, off_t size,
+                   off_t offset)
+{
+  uint8_t bounce[INODE_INLINE_MAX];
+  off_t left;
 
-      start = DIRECT_BLOCKS + INDIRECT_BLOCKS * INDEX_BLOCK_ENTRIES;
-      offset_mult_4096 = (start + (INDEX_BLOCK_ENTRIES * INDEX_BLOCK_ENTRIES * (main_idx - start)));
-      // [0..4097]
-      inner_idx = sector_inode_relative - offset_mult_4096;
-      
-      //Find double index inode sector
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (index_inode->data->index.block_index, inner_idx, true);
+  rwlock_acquire_read (&inode->inode_growth);
+  if (!(inode->data->flags & INODE_INLINE))
+    {
+      rwlock_release_read (&inode->inode_growth);
+      return -1;
+    }
+  left = inode->logical_length - offset;
+  if (size > left)
+    size = left;
+  if (size > 0)
+    memcpy (bounce, inode->data->index.inline_data + offset, size);
+  rwlock_release_read (&inode->inode_growth);
+
+  if (size <= 0)
+    return 0;
+  memcpy (buffer, bounce, size);
+  return size;
+}
 
-      d_index_inode = inode_open (sector);
-      ASSERT (d_index_inode != NULL);
-      inode_load_disk (d_index_inode);
-      ASSERT (d_index_inode->data->is_index_block);
+/* Writes SIZE bytes from BUFFER into the data stored in INODE itself,
+   starting at OFFSET. Returns the number of bytes written, or -1 if
+   the data is no longer inline, either because it did not fit and was
+   moved to data sectors or because another writer did that first.
+   The caller then writes through the sectors. */
+static off_t
+inode_write_inline (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset)
+{
+  uint8_t bounce[INODE_INLINE_MAX];
+  bool fits = offset + size <= INODE_INLINE_MAX;
 
-      start = DIRECT_BLOCKS + INDIRECT_BLOCKS * INDEX_BLOCK_ENTRIES;
-      offset_mult_64 = (start + (INDEX_BLOCK_ENTRIES * (main_idx - start)));
-      // [0..63]
-      d_inner_idx = sector_inode_relative - offset_mult_64;
+  if (size <= 0 || inode->deny_write_cnt != 0)
+    return 0;
+  if (fits)
+    memcpy (bounce, buffer, size);
+
+  rwlock_acquire_write (&inode->inode_growth);
+  if (!(inode->data->flags & INODE_INLINE))
+    {
+      rwlock_release_write (&inode->inode_growth);
+      return -1;
+    }
+  if (!fits)
+    {
+      bool moved = inode_uninline (inode);
+      rwlock_release_write (&inode->inode_growth);
+      return moved ? -1 : 0;
+    }
+
+  memcpy (inode->data->index.inline_data + offset, bounce, size);
+  if (offset + size > inode->data->length)
+    inode->data->length = offset + size;
+  inode->logical_length = inode->data->length;
+  inode->data_dirty = true;
+  rwlock_release_write (&inode->inode_growth);
+
+  return size;
+}
+
+/* Moves the data stored in INODE itself to a data sector, if it has
+   any, laid out as an index or as extents like any new inode. Returns false, leaving
+   INODE as it was, if no sector is left. Call with inode_growth held
+   exclusive. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct inode_disk *data = inode->data;
+  union index_table saved = data->index;
+  off_t length = data->length;
 
-      sector = CHECK_ALLOCATE_AND_GET_SECTOR (d_index_inode->data->index.block_index, d_inner_idx, false);
+  ASSERT (rwlock_held_by_current_thread (&inode->inode_growth));
+  ASSERT (data->flags & INODE_INLINE);
 
-      inode_release_disk (d_index_inode);
-      inode_release_disk (index_inode);
+  if (use_extents)
+    {
+      data->flags = INODE_EXTENT_MAP;
+      data->extent_cnt = 0;
+      if (length > 0 && !inode_grow_extents (inode, 1))
+        goto fail;
     }
   else
     {
-      PANIC ("OUT OF MEMORY: Trying to write to disk a file or folder greater than 8MB!");
+      data->flags = 0;
+      for (int i = 0; i < INDEX_MAIN_ENTRIES; i++)
+        data->index.main_index[i] = SECTOR_ERROR;
+      if (length > 0
+          && allocate_new_block (data->index.main_index, 0,
+                                 inode->sector) == SECTOR_ERROR)
+        goto fail;
+      data->start = data->index.main_index[0];
+    }
+
+  // The first data sector is zeroed: copy what was inline over it
+  if (length > 0)
+    bc_block_write (data->start, saved.inline_data, 0, length);
+  inode_run_invalidate (inode);
+  inode->data_dirty = true;
+  return true;
+
+ fail:
+  data->flags = INODE_INLINE;
+  data->index = saved;
+  return false;
+}
+
+/* Returns the disk sector holding byte POS of INODE, allocating it
+   and any missing index blocks on the way if ALLOCATE_NEW. Returns
+   SECTOR_ERROR if the sector is not allocated, or could not be, or
+   POS is past the largest file the index can describe. */
+block_sector_t inode_pos_to_real_sector (struct inode *inode, off_t pos, bool allocate_new)
+{
+  return index_walk (inode, pos, allocate_new, SECTOR_ERROR);
+}
+
+/* Does the work of inode_pos_to_real_sector(). If DATA is not
+   SECTOR_ERROR, it is an allocated and zeroed sector to use if the
+   data sector is missing. Sectors allocated here are placed after the
+   data sector before POS if there is one, else after the inode. */
+static block_sector_t
+index_walk (struct inode *inode, off_t pos, bool allocate_new,
+            block_sector_t data)
+{
+  ASSERT (inode != NULL);
+  ASSERT (pos >= 0);
+  block_sector_t sector_inode_relative = pos / BLOCK_SECTOR_SIZE;
+  const struct index_region *r;
+  block_sector_t rel = sector_inode_relative;
+  block_sector_t sector, top, span = 1;
+  block_sector_t hint = inode->sector;
+  int level;
+
+  if (inode->data->flags & INODE_EXTENT_MAP)
+    { /* Extents are only allocated by inode_grow */
+      ASSERT (!allocate_new);
+      return inode_extent_to_sector (inode->data, sector_inode_relative);
+    }
+
+  /* Find the region, and the size of the subtree under each of its
+     entries */
+  for (r = index_regions; ; r++)
+    {
+      if (r == index_regions + sizeof index_regions / sizeof *index_regions)
+        return SECTOR_ERROR;
+      for (span = 1, level = 0; level < r->depth; level++)
+        span *= INDEX_BLOCK_ENTRIES;
+      if (rel / span < r->count)
+        break;
+      rel -= r->count * span;
+    }
+
+  if (allocate_new && data == SECTOR_ERROR && pos >= BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t prev = index_walk (inode, pos - BLOCK_SECTOR_SIZE,
+                                        false, SECTOR_ERROR);
+      if (prev != SECTOR_ERROR)
+        hint = prev + 1;
+    }
+
+  top = inode->data->index.main_index[r->first + rel / span];
+  sector = index_entry (inode->data->index.main_index, r->first + rel / span,
+                        r->depth > 0, allocate_new, data, hint);
+  if (r->depth > 0 && top == SECTOR_ERROR && sector != SECTOR_ERROR)
+    inode_pin_index (inode, sector);
+
+  /* Walk down one index block per level, reading just the entry
+     needed from the cache */
+  for (level = r->depth; level > 0 && sector != SECTOR_ERROR; level--)
+    {
+      rel %= span;
+      span /= INDEX_BLOCK_ENTRIES;
+      sector = index_block_entry (sector, rel / span, level > 1,
+                                  allocate_new, data, hint);
     }
 
   return sector;
 }
 
-// Allocates block and sets entry in inode index
-block_sector_t allocate_new_block (block_sector_t *table, block_sector_t idx)
+/* Returns entry IDX of TABLE, first allocating an index block or a
+   zeroed data block for it near HINT if it is empty and ALLOCATE_NEW.
+   A data block is DATA instead, if it is not SECTOR_ERROR. */
+static block_sector_t
+index_entry (block_sector_t *table, size_t idx, bool is_index_block,
+             bool allocate_new, block_sector_t data, block_sector_t hint)
+{
+  if (allocate_new && table[idx] == SECTOR_ERROR)
+    {
+      if (is_index_block)
+        return allocate_new_index_inode (table, idx, hint);
+      else if (data != SECTOR_ERROR)
+        return table[idx] = data;
+      else
+        return allocate_new_block (table, idx, hint);
+    }
+  return table[idx];
+}
+
+/* Returns entry IDX of the index block at SECTOR, allocating it as
+   index_entry() does. Only the entry itself is read from, and
+   written to, the buffer cache. */
+static block_sector_t
+index_block_entry (block_sector_t sector, size_t idx, bool is_index_block,
+                   bool allocate_new, block_sector_t data, block_sector_t hint)
+{
+  off_t ofs = offsetof (struct inode_disk, index.block_index[idx]);
+  block_sector_t entry;
+
+  bc_block_read (sector, &entry, ofs, sizeof entry);
+  if (allocate_new && entry == SECTOR_ERROR)
+    {
+      entry = index_entry (&entry, 0, is_index_block, allocate_new, data, hint);
+      if (entry != SECTOR_ERROR)
+        bc_block_write (sector, &entry, ofs, sizeof entry);
+    }
+  return entry;
+}
+
+/* Releases the CNT sectors in TABLE that are allocated, each the root
+   of a tree of index blocks DEPTH levels deep, and everything under
+   them. */
+static void
+inode_free_index (const block_sector_t *table, size_t cnt, int depth)
+{
+  struct inode_disk *index = NULL;
+
+  if (depth > 0)
+    {
+      index = malloc (sizeof *index);
+      if (index == NULL)
+        PANIC ("No memory left");
+    }
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      if (table[i] == SECTOR_ERROR)
+        continue;
+      if (depth > 0)
+        {
+          bc_block_read (table[i], index, 0, BLOCK_SECTOR_SIZE);
+          inode_free_index (index->index.block_index, INDEX_BLOCK_ENTRIES,
+                            depth - 1);
+        }
+      free_map_release (table[i], 1);
+    }
+
+  free (index);
+}
+
+// Allocates block near HINT and sets entry in inode index
+block_sector_t allocate_new_block (block_sector_t *table, block_sector_t idx,
+                                   block_sector_t hint)
 {
   static char zeros[BLOCK_SECTOR_SIZE];
   block_sector_t allocated_sector = 0;
-  if (!free_map_allocate (1, &allocated_sector))
+  if (!free_map_allocate_near (hint, 1, &allocated_sector))
     return SECTOR_ERROR;
 
   bc_block_write (allocated_sector, zeros, 0, BLOCK_SECTOR_SIZE);
@@ -575,21 +1424,39 @@ block_sector_t allocate_new_block (block_sector_t *table, block_sector_t idx)
   return allocated_sector;
 }
 
-// Allocates index inode and sets entry in inode index
-block_sector_t allocate_new_index_inode (block_sector_t *table, block_sector_t idx)
+// Allocates index inode near HINT and sets entry in inode index
+block_sector_t allocate_new_index_inode (block_sector_t *table, block_sector_t idx,
+                                         block_sector_t hint)
 {
   block_sector_t allocated_sector = 0;
-  if (!free_map_allocate (1, &allocated_sector))
+  if (!free_map_allocate_near (hint, 1, &allocated_sector))
     return SECTOR_ERROR;
 
   if (!inode_create (allocated_sector, 0, 0, true))
-    return SECTOR_ERROR;
+    {
+      free_map_release (allocated_sector, 1);
+      return SECTOR_ERROR;
+    }
   table[idx] = allocated_sector;
 
   return allocated_sector;
 }
 
-off_t round_up_to_sector_boundary (off_t bytes)
+//**** Hash table functionalities
+
+static unsigned
+open_inode_hash (const struct hash_elem *he, void *aux UNUSED)
+{
+  struct inode *inode = hash_entry (he, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+static bool
+open_inode_less (const struct hash_elem *ha, const struct hash_elem *hb,
+                 void *aux UNUSED)
 {
-  return sectors_to_bytes (bytes_to_sectors (bytes));
-}
\ No newline at end of file
+  struct inode *a = hash_entry (ha, struct inode, elem);
+  struct inode *b = hash_entry (hb, struct inode, elem);
+
+  return a->sector < b->sector;
+}
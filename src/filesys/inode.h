@@ -6,6 +6,7 @@
 #include "devices/block.h"
 #include "threads/synch.h"
 #include "lib/kernel/list.h"
+#include "lib/kernel/hash.h"
 
 struct bitmap;
 
@@ -13,28 +14,46 @@ struct bitmap;
 #define INODE_MAGIC 0x494e4f44
 #define DIRECT_BLOCKS 11
 #define INDIRECT_BLOCKS 65
-#define D_INDIRECT_BLOCKS 3
-#define METADATA_BLOCKS (1 + INDIRECT_BLOCKS + D_INDIRECT_BLOCKS * D_INDIRECT_BLOCKS)
-#define INDEX_MAIN_ENTRIES (DIRECT_BLOCKS + INDIRECT_BLOCKS + D_INDIRECT_BLOCKS)
+#define D_INDIRECT_BLOCKS 1
+#define T_INDIRECT_BLOCKS 1
+#define Q_INDIRECT_BLOCKS 1
+#define INDEX_MAIN_ENTRIES (DIRECT_BLOCKS + INDIRECT_BLOCKS + D_INDIRECT_BLOCKS \
+                            + T_INDIRECT_BLOCKS + Q_INDIRECT_BLOCKS)
 #define INDEX_BLOCK_ENTRIES 64
-#define UNUSED_SIZE (123-INDEX_MAIN_ENTRIES)
+#define INDEX_MAX_DEPTH 4               /* Levels of index blocks under Q_INDIRECT */
+#define UNUSED_SIZE (121-INDEX_MAIN_ENTRIES)
+#define INODE_EXTENTS (INDEX_MAIN_ENTRIES / 2)
+#define INODE_INLINE_MAX (INDEX_MAIN_ENTRIES * 4) /* Bytes of data kept in the inode */
+
+/* Inode flags. */
+#define INODE_EXTENT_MAP 0x1            /* Data stored as extents, not an index */
+#define INODE_INLINE 0x2                /* Data stored in the inode itself */
+#define INODE_HASHED_DIR 0x4            /* Directory entries kept in a hash table */
 #define SECTOR_ERROR (6666666)
+#define INODE_PINNED_MAX 8
+#define INODE_PINNED_INDEX (INODE_PINNED_MAX / 2) /* Of which top-level index blocks */
+#define INODE_RUNS 8
+
+/* The main index is split in regions: DIRECT_BLOCKS entries point
+   to data sectors, each of the next INDIRECT_BLOCKS to an index block
+   of data sectors, and the last three entries to trees of index
+   blocks two, three and four levels deep. Reaching a sector thus takes
+   at most INDEX_MAX_DEPTH index blocks, and the four level tree alone
+   covers 64^4 sectors (8 GB), more than an off_t can address. */
 
-/* When accessing a sector number relative to an inode, each of these numbers 
-   represent in which part of the table that sector should be looked for.
-   Another way to think of these: they are indexes that split the table. */
-#define INODE_ACCESS_DIRECT (DIRECT_BLOCKS - 1)
-#define INODE_ACCESS_INDIRECT \
-(INODE_ACCESS_DIRECT + (INDIRECT_BLOCKS * INDEX_BLOCK_ENTRIES)) // 4170
-#define INODE_ACCESS_MAX \
-(INODE_ACCESS_INDIRECT + \
-(D_INDIRECT_BLOCKS * INDEX_BLOCK_ENTRIES * INDEX_BLOCK_ENTRIES) \
-- METADATA_BLOCKS) // 16383
+/* Consecutive data sectors stored in consecutive disk sectors. */
+struct inode_extent
+  {
+    block_sector_t start;               /* First disk sector. */
+    block_sector_t length;              /* Number of sectors. */
+  };
 
 union index_table
   {
     block_sector_t main_index[INDEX_MAIN_ENTRIES];		/* Main index of next blocks */
     block_sector_t block_index[INDEX_BLOCK_ENTRIES];	/* Supplementary index if it is an index block */
+    struct inode_extent extents[INODE_EXTENTS];		/* Data runs if INODE_EXTENT_MAP is set */
+    uint8_t inline_data[INODE_INLINE_MAX];		/* File data if INODE_INLINE is set */
   };
 
 /* On-disk inode.
@@ -46,28 +65,51 @@ struct inode_disk
     off_t length;                       	/* File size in bytes. */
   	union index_table index;							/* Main index or supplementary index */
     uint32_t is_index_block;							/* Is it a normal data block or an index block? */
+    uint32_t flags;                     	/* INODE_* flags. */
+    uint32_t extent_cnt;                	/* Extents in use if INODE_EXTENT_MAP. */
     unsigned magic;                     	/* Magic number. */
     uint32_t unused[UNUSED_SIZE];    			/* Not used. */
   };
 
+/* Consecutive sectors of an inode's data stored in consecutive disk
+   sectors, remembered to skip walking the index blocks. */
+struct inode_run
+  {
+    block_sector_t logical;             /* First sector within the data. */
+    block_sector_t physical;            /* Its disk sector. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in the open inodes table. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    int close_cnt;                      /* Last closers writing it back. */
     int open_fd_cnt;					          /* Number of open fds on this dir. */
     int cwd_cnt;                        /* Number of processes that have this dir as cwd. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk* data;            /* Inode content. */
+    struct inode_disk* data;            /* Inode content, kept until the last close. */
+    bool data_dirty;                    /* DATA changed since it was written. */
     struct lock inode_lock;             /* Used to synchronize file loading */
-    struct lock inode_growth;           /* Used to synchronize file growth */
-    int access_count;                   /* Number of threads currently using this inode */
+    struct rwlock inode_growth;         /* Shared to find data sectors, exclusive to add them */
+    struct lock dir_lock;               /* Serializes changes to a directory's entries */
     off_t logical_length;               /* Physical size minus what still needs to be initialized */
+    block_sector_t pinned[INODE_PINNED_MAX]; /* Sectors pinned in the cache while open */
+    off_t pinned_ofs[INODE_PINNED_MAX]; /* Data offset of each, -1 for metadata */
+    size_t pinned_cnt;
+    struct lock pin_lock;               /* Protects the pinned sectors */
+    struct inode_run runs[INODE_RUNS];  /* Translations found so far */
+    size_t run_cnt;
+    size_t run_next;                    /* Slot to replace when full */
+    struct lock run_lock;               /* Protects the runs */
   };
 
 void inode_init (void);
+void inode_use_extents (bool);
+void inode_detect_layout (void);
 bool inode_create (block_sector_t sector, off_t length, block_sector_t parent, bool is_index_block);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -76,14 +118,21 @@ block_sector_t inode_get_parent (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+off_t inode_read_page (struct inode *, void *page, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (struct inode *);
+bool inode_is_hashed_dir (struct inode *);
+void inode_set_hashed_dir (struct inode *);
+bool inode_pin (struct inode *, off_t offset);
 bool inode_grow (struct inode *inode, off_t size, off_t offset);
-block_sector_t inode_pos_to_real_sector (const struct inode *inode, off_t pos, bool allocate_new);
-block_sector_t allocate_new_block (block_sector_t *table, block_sector_t idx);
-block_sector_t allocate_new_index_inode (block_sector_t *table, block_sector_t idx);
-off_t round_up_to_sector_boundary (off_t bytes);
+bool inode_allocate (struct inode *, off_t size, bool keep_size);
+block_sector_t inode_pos_to_real_sector (struct inode *inode, off_t pos, bool allocate_new);
+block_sector_t allocate_new_block (block_sector_t *table, block_sector_t idx,
+                                   block_sector_t hint);
+block_sector_t allocate_new_index_inode (block_sector_t *table, block_sector_t idx,
+                                         block_sector_t hint);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,24 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Number of equally sized slices of the file system device that
+   buffer cache lookups are counted in. */
+#define CACHE_HEAT_BUCKETS 16
+
+/* Buffer cache counters, kept by the kernel since boot and returned
+   by the cachestat() system call. */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Lookups that found their sector. */
+    unsigned long long misses;          /* Lookups that had to claim an entry. */
+    unsigned long long bypassed;        /* Sectors read around the cache. */
+    unsigned long long evictions;       /* Sectors dropped to make room. */
+    unsigned long long flushes;         /* Dirty sectors written back. */
+    unsigned long long ra_hits;         /* Prefetched sectors read later. */
+    unsigned long long ra_wasted;       /* Prefetched sectors dropped unread. */
+    unsigned long long lock_waits;      /* Times a thread found an entry busy. */
+    unsigned long long lock_wait_ticks; /* Timer ticks spent waiting for it. */
+    unsigned long long heat[CACHE_HEAT_BUCKETS]; /* Lookups per slice. */
+  };
+
+#endif /* lib/cache-stats.h */
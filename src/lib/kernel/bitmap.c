@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -21,6 +22,11 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Keep a summary level, one bit per element that has all its bits
+   set, so that scans for unset bits in a nearly full bitmap skip the
+   full elements ELEM_BITS at a time. */
+#define ENABLE_BITMAP_SUMMARY
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
    simulates an array of bits. */
@@ -28,6 +34,7 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary: bit I set if element I is full. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -68,6 +75,67 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of elements of summary for BIT_CNT bits. */
+static inline size_t
+summary_cnt (size_t bit_cnt)
+{
+#ifdef ENABLE_BITMAP_SUMMARY
+  return elem_cnt (elem_cnt (bit_cnt));
+#else
+  (void) bit_cnt;
+  return 0;
+#endif
+}
+
+/* Brings the summary bit of element IDX of B up to date after the
+   element changed.  Unless no other thread can use B yet, call with
+   interrupts off since before the change, so that the element and
+   its summary bit change atomically: two threads changing the same
+   element could otherwise leave a stale "full" bit, hiding free
+   bits from bitmap_scan() for good. */
+static inline void
+summary_update (struct bitmap *b, size_t idx)
+{
+#ifdef ENABLE_BITMAP_SUMMARY
+  elem_type used = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b)
+                                                    : (elem_type) -1;
+
+  if ((b->bits[idx] & used) == used)
+    b->full[elem_idx (idx)] |= bit_mask (idx);
+  else
+    b->full[elem_idx (idx)] &= ~bit_mask (idx);
+#else
+  (void) b;
+  (void) idx;
+#endif
+}
+
+/* Atomically sets the bits of MASK in *E.  This is equivalent to
+   `*e |= mask' except that it is guaranteed to be atomic on a
+   uniprocessor machine.  See the description of the OR instruction
+   in [IA32-v2b]. */
+static inline void
+elem_or (elem_type *e, elem_type mask)
+{
+  asm ("or %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+}
+
+/* Atomically clears the bits of *E not in MASK, like `*e &= mask'.
+   See the description of the AND instruction in [IA32-v2a]. */
+static inline void
+elem_and (elem_type *e, elem_type mask)
+{
+  asm ("and %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+}
+
+/* Atomically toggles the bits of MASK in *E, like `*e ^= mask'.
+   See the description of the XOR instruction in [IA32-v2b]. */
+static inline void
+elem_xor (elem_type *e, elem_type mask)
+{
+  asm ("xor %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+}
 
 /* Creation and destruction. */
 
@@ -82,9 +150,11 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (byte_cnt (bit_cnt)
+                        + summary_cnt (bit_cnt) * sizeof (elem_type));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          b->full = b->bits + elem_cnt (bit_cnt);
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +175,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->bits + elem_cnt (bit_cnt);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +185,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + byte_cnt (bit_cnt)
+         + summary_cnt (bit_cnt) * sizeof (elem_type);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -157,12 +229,11 @@ void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level = intr_disable ();
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  elem_or (&b->bits[idx], bit_mask (bit_idx));
+  summary_update (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -170,12 +241,11 @@ void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level = intr_disable ();
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  elem_and (&b->bits[idx], ~bit_mask (bit_idx));
+  summary_update (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -185,12 +255,11 @@ void
 bitmap_flip (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level = intr_disable ();
 
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  elem_xor (&b->bits[idx], bit_mask (bit_idx));
+  summary_update (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +282,34 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE, an element
+   at a time.  Each element is set atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+      elem_type mask = n == ELEM_BITS ? (elem_type) -1
+                                      : (((elem_type) 1 << n) - 1) << ofs;
+      enum intr_level old_level = intr_disable ();
+
+      if (value)
+        elem_or (&b->bits[idx], mask);
+      else
+        elem_and (&b->bits[idx], ~mask);
+      summary_update (b, idx);
+      intr_set_level (old_level);
+
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -291,20 +376,76 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   The bits are examined an element at a time: runs of bits equal to
+   VALUE are measured with a find-first-set, so that each element
+   costs a few instructions whatever CNT is.  Looking for unset bits,
+   full elements are skipped using the summary. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t run_start = start;             /* First bit of the current run. */
+  size_t run_len = 0;                   /* Its length so far. */
+  size_t idx;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt - start)
+    return BITMAP_ERROR;
+
+  for (idx = elem_idx (start); idx < elem_cnt (b->bit_cnt); idx++)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t ofs = 0;
+      elem_type x;
+
+#ifdef ENABLE_BITMAP_SUMMARY
+      if (!value && (b->full[elem_idx (idx)] & bit_mask (idx)))
+        {
+          /* No unset bit here, maybe in none of the next elements */
+          if (idx % ELEM_BITS == 0 && b->full[elem_idx (idx)] == (elem_type) -1)
+            idx += ELEM_BITS - 1;
+          run_len = 0;
+          continue;
+        }
+#endif
+
+      /* Bits equal to VALUE become 1, those outside the range 0 */
+      x = value ? b->bits[idx] : ~b->bits[idx];
+      if (idx == elem_idx (start))
+        x &= (elem_type) -1 << (start % ELEM_BITS);
+      if (idx == elem_cnt (b->bit_cnt) - 1)
+        x &= last_mask (b);
+
+      while (ofs < ELEM_BITS)
+        {
+          elem_type y = x >> ofs;
+
+          if (y == 0)
+            {
+              run_len = 0;
+              break;
+            }
+          if (y & 1)
+            {
+              size_t n = ~y == 0 ? ELEM_BITS : (size_t) __builtin_ctzl (~y);
+
+              if (run_len == 0)
+                run_start = idx * ELEM_BITS + ofs;
+              run_len += n;
+              if (run_len >= cnt)
+                return run_start;
+              ofs += n;
+            }
+          else
+            {
+              run_len = 0;
+              ofs += __builtin_ctzl (y);
+            }
+        }
     }
   return BITMAP_ERROR;
 }
@@ -344,8 +485,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t idx;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (idx = 0; idx < elem_cnt (b->bit_cnt); idx++)
+        summary_update (b, idx);
     }
   return success;
 }
@@ -358,6 +503,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte OFS, as laid out by
+   bitmap_write(), to the same offset in FILE, stopping at the end
+   of B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Buffer cache instrumentation. */
+    SYS_CACHESTAT,              /* Reads the buffer cache counters. */
+
+    /* Space reservation. */
+    SYS_FALLOCATE               /* Reserves disk space for a file. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+cachestat (struct cache_stats *stats)
+{
+  return syscall1 (SYS_CACHESTAT, stats);
+}
+
+bool
+fallocate (int fd, unsigned size, bool keep_size)
+{
+  return syscall3 (SYS_FALLOCATE, fd, size, (int) keep_size);
+}
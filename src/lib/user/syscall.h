@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Buffer cache instrumentation. */
+bool cachestat (struct cache_stats *);
+
+/* Space reservation. */
+bool fallocate (int fd, unsigned size, bool keep_size);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,51 @@
+/* Reads a small file twice and checks, through the cachestat
+   system call, that the second pass is served by the buffer
+   cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 4096
+
+static char buf[FILE_SIZE];
+
+static void
+read_file (int fd)
+{
+  seek (fd, 0);
+  if (read (fd, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("read \"cached\" failed");
+}
+
+void
+test_main (void)
+{
+  struct cache_stats before, after;
+  unsigned long long hits, misses;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("cached", 0), "create \"cached\"");
+  CHECK ((fd = open ("cached")) > 1, "open \"cached\"");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"cached\"");
+  read_file (fd);
+
+  CHECK (cachestat (&before), "cachestat");
+  msg ("read \"cached\" again");
+  read_file (fd);
+  CHECK (cachestat (&after), "cachestat");
+  msg ("close \"cached\"");
+  close (fd);
+
+  hits = after.hits - before.hits;
+  misses = after.misses - before.misses;
+  if (hits < FILE_SIZE / 512)
+    fail ("only %llu hits reading back %d bytes", hits, FILE_SIZE);
+  if (misses >= hits)
+    fail ("%llu misses for %llu hits on a cached file", misses, hits);
+  msg ("second pass served by the cache");
+}
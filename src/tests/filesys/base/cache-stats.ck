@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stats) begin
+(cache-stats) create "cached"
+(cache-stats) open "cached"
+(cache-stats) write "cached"
+(cache-stats) cachestat
+(cache-stats) read "cached" again
+(cache-stats) cachestat
+(cache-stats) close "cached"
+(cache-stats) second pass served by the cache
+(cache-stats) end
+EOF
+pass;
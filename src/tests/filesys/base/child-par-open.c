@@ -0,0 +1,35 @@
+/* Child process for par-open test.
+   Opens its own file by full path OPEN_PASSES times, checks that
+   it has the expected length and closes it again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/par-open.h"
+
+const char *test_name = "child-par-open";
+
+int
+main (int argc, const char *argv[]) 
+{
+  char file_name[32];
+  int child_idx;
+  int pass;
+  int fd;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (file_name, sizeof file_name, "/open/d%d/file", child_idx);
+
+  for (pass = 0; pass < OPEN_PASSES; pass++) 
+    {
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      CHECK (filesize (fd) == child_idx, "filesize \"%s\"", file_name);
+      close (fd);
+    }
+
+  return child_idx;
+}
@@ -0,0 +1,66 @@
+/* Child process for par-reopen test.
+   Child 0 removes and recreates "victim" REOPEN_PASSES times,
+   growing "filler" by a sector of 0xff bytes each time. The others
+   open "victim" as many times, and check that whenever the open
+   succeeds the file has the length it was created with. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/par-reopen.h"
+
+const char *test_name = "child-par-reopen";
+
+static char junk[512];
+
+static void
+remove_and_recreate (void) 
+{
+  int pass;
+  int fd;
+
+  memset (junk, 0xff, sizeof junk);
+  CHECK ((fd = open ("filler")) > 1, "open \"filler\"");
+  for (pass = 0; pass < REOPEN_PASSES; pass++) 
+    {
+      CHECK (remove ("victim"), "remove \"victim\"");
+      CHECK (write (fd, junk, sizeof junk) == sizeof junk,
+             "write \"filler\"");
+      CHECK (create ("victim", FILE_SIZE), "create \"victim\"");
+    }
+  close (fd);
+}
+
+static void
+reopen (void) 
+{
+  int pass;
+  int fd;
+
+  for (pass = 0; pass < REOPEN_PASSES; pass++) 
+    if ((fd = open ("victim")) > 1)
+      {
+        CHECK (filesize (fd) == FILE_SIZE,
+               "filesize \"victim\" is %d, expected %d",
+               filesize (fd), FILE_SIZE);
+        close (fd);
+      }
+}
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  if (child_idx == 0)
+    remove_and_recreate ();
+  else
+    reopen ();
+
+  return child_idx;
+}
@@ -0,0 +1,40 @@
+/* Reserves space for a file without changing its length, fills it,
+   then reserves past its end with the length following, and checks
+   that the reserved space reads back as zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 8192
+
+static char buf[FILE_SIZE * 2];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, FILE_SIZE);
+
+  CHECK (create ("reserved", 0), "create \"reserved\"");
+  CHECK ((fd = open ("reserved")) > 1, "open \"reserved\"");
+  CHECK (fallocate (fd, FILE_SIZE, true), "reserve %d bytes", FILE_SIZE);
+  CHECK (filesize (fd) == 0, "length still 0");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"reserved\"");
+  CHECK (filesize (fd) == FILE_SIZE, "length %d", FILE_SIZE);
+
+  CHECK (fallocate (fd, FILE_SIZE * 2, false),
+         "allocate %d bytes", FILE_SIZE * 2);
+  CHECK (filesize (fd) == FILE_SIZE * 2, "length %d", FILE_SIZE * 2);
+  msg ("close \"reserved\"");
+  close (fd);
+
+  memset (buf + FILE_SIZE, 0, FILE_SIZE);
+  check_file ("reserved", buf, sizeof buf);
+
+  CHECK (!fallocate (fd, FILE_SIZE, false), "allocate on closed fd fails");
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "reserved"
+(fallocate) open "reserved"
+(fallocate) reserve 8192 bytes
+(fallocate) length still 0
+(fallocate) write "reserved"
+(fallocate) length 8192
+(fallocate) allocate 16384 bytes
+(fallocate) length 16384
+(fallocate) close "reserved"
+(fallocate) open "reserved" for verification
+(fallocate) verified contents of "reserved"
+(fallocate) close "reserved"
+(fallocate) allocate on closed fd fails
+(fallocate) end
+EOF
+pass;
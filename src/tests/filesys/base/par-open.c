@@ -0,0 +1,35 @@
+/* Creates a directory per child process inside a shared one, with
+   one file in each, then spawns the children, each of which opens
+   its own file by full path and closes it again over and over,
+   without reading it. Every open looks up the shared directory and
+   then the child's own: this measures how well path lookups and
+   opens of unrelated files run side by side. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/par-open.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char name[32];
+  size_t i;
+
+  CHECK (mkdir ("/open"), "mkdir \"/open\"");
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/open/d%zu", i);
+      CHECK (mkdir (name), "mkdir \"%s\"", name);
+
+      /* Each file's length is its child's index, so that a child
+         can tell it opened the right one. */
+      snprintf (name, sizeof name, "/open/d%zu/file", i);
+      CHECK (create (name, i), "create \"%s\"", name);
+    }
+
+  exec_children ("child-par-open", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
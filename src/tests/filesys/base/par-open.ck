@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-open) begin
+(par-open) mkdir "/open"
+(par-open) mkdir "/open/d0"
+(par-open) create "/open/d0/file"
+(par-open) mkdir "/open/d1"
+(par-open) create "/open/d1/file"
+(par-open) mkdir "/open/d2"
+(par-open) create "/open/d2/file"
+(par-open) mkdir "/open/d3"
+(par-open) create "/open/d3/file"
+(par-open) exec child 1 of 4: "child-par-open 0"
+(par-open) exec child 2 of 4: "child-par-open 1"
+(par-open) exec child 3 of 4: "child-par-open 2"
+(par-open) exec child 4 of 4: "child-par-open 3"
+(par-open) wait for child 1 of 4 returned 0 (expected 0)
+(par-open) wait for child 2 of 4 returned 1 (expected 1)
+(par-open) wait for child 3 of 4 returned 2 (expected 2)
+(par-open) wait for child 4 of 4 returned 3 (expected 3)
+(par-open) end
+EOF
+
+# Report throughput, so that runs can be compared across changes to
+# file system locking.
+our ($test);
+my ($ticks) = map (/^Timer: (\d+) ticks/, read_text_file ("$test.output"));
+my (%def) = read_c_defines ($0 =~ s/\.ck$/.h/r);
+my ($opens) = $def{CHILD_CNT} * $def{OPEN_PASSES};
+printf STDOUT ("par-open: %d opens in %d ticks\n", $opens, $ticks)
+  if defined $ticks && $ticks > 0;
+pass;
@@ -0,0 +1,7 @@
+#ifndef TESTS_FILESYS_BASE_PAR_OPEN_H
+#define TESTS_FILESYS_BASE_PAR_OPEN_H
+
+#define CHILD_CNT 4
+#define OPEN_PASSES 64
+
+#endif /* tests/filesys/base/par-open.h */
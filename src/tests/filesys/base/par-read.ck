@@ -0,0 +1,43 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-read) begin
+(par-read) create "data0"
+(par-read) open "data0"
+(par-read) write "data0"
+(par-read) close "data0"
+(par-read) create "data1"
+(par-read) open "data1"
+(par-read) write "data1"
+(par-read) close "data1"
+(par-read) create "data2"
+(par-read) open "data2"
+(par-read) write "data2"
+(par-read) close "data2"
+(par-read) create "data3"
+(par-read) open "data3"
+(par-read) write "data3"
+(par-read) close "data3"
+(par-read) exec child 1 of 4: "child-par-read 0"
+(par-read) exec child 2 of 4: "child-par-read 1"
+(par-read) exec child 3 of 4: "child-par-read 2"
+(par-read) exec child 4 of 4: "child-par-read 3"
+(par-read) wait for child 1 of 4 returned 0 (expected 0)
+(par-read) wait for child 2 of 4 returned 1 (expected 1)
+(par-read) wait for child 3 of 4 returned 2 (expected 2)
+(par-read) wait for child 4 of 4 returned 3 (expected 3)
+(par-read) end
+EOF
+
+# Report throughput, so that kernels built with and without
+# ENABLE_CONCURRENT_MISS (see filesys/cache.c) can be compared.
+our ($test);
+my ($ticks) = map (/^Timer: (\d+) ticks/, read_text_file ("$test.output"));
+my (%def) = read_c_defines ($0 =~ s/\.ck$/.h/r);
+my ($bytes) = $def{CHILD_CNT} * $def{READ_PASSES} * $def{FILE_SIZE};
+printf STDOUT ("par-read: %d bytes read in %d ticks (%d bytes/tick)\n",
+	       $bytes, $ticks, $bytes / $ticks)
+  if defined $ticks && $ticks > 0;
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_PAR_READ_H
+#define TESTS_FILESYS_BASE_PAR_READ_H
+
+#define CHILD_CNT 4
+#define FILE_SIZE (48 * 1024)   /* Together the files exceed the cache. */
+#define READ_PASSES 2
+
+#endif /* tests/filesys/base/par-read.h */
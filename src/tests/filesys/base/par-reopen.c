@@ -0,0 +1,22 @@
+/* Spawns child processes that open the same name at the same time
+   as another child removes and recreates it. The remover also grows
+   a second file with bytes that make no sense as an inode, which
+   may take over the sectors just freed, so that an open that races
+   with the removal and reads the freed sector sees a bogus length. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/par-reopen.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+
+  CHECK (create ("victim", FILE_SIZE), "create \"victim\"");
+  CHECK (create ("filler", 0), "create \"filler\"");
+
+  exec_children ("child-par-reopen", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
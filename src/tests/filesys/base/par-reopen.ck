@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-reopen) begin
+(par-reopen) create "victim"
+(par-reopen) create "filler"
+(par-reopen) exec child 1 of 4: "child-par-reopen 0"
+(par-reopen) exec child 2 of 4: "child-par-reopen 1"
+(par-reopen) exec child 3 of 4: "child-par-reopen 2"
+(par-reopen) exec child 4 of 4: "child-par-reopen 3"
+(par-reopen) wait for child 1 of 4 returned 0 (expected 0)
+(par-reopen) wait for child 2 of 4 returned 1 (expected 1)
+(par-reopen) wait for child 3 of 4 returned 2 (expected 2)
+(par-reopen) wait for child 4 of 4 returned 3 (expected 3)
+(par-reopen) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_PAR_REOPEN_H
+#define TESTS_FILESYS_BASE_PAR_REOPEN_H
+
+#define CHILD_CNT 4
+#define FILE_SIZE 1024
+#define REOPEN_PASSES 64
+
+#endif /* tests/filesys/base/par-reopen.h */
@@ -0,0 +1,52 @@
+/* Opens a file at the bottom of a deep tree of directories over and
+   over, and checks through the cachestat system call that resolving
+   its path does not read every directory on the way each time, as it
+   would without the name cache. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 16
+#define OPEN_CNT 10
+
+static char path[DEPTH * 2 + 16];
+
+void
+test_main (void)
+{
+  struct cache_stats before, after;
+  unsigned long long lookups;
+  int fd;
+  int i;
+
+  msg ("creating a tree %d directories deep...", DEPTH);
+  for (i = 0; i < DEPTH; i++)
+    {
+      strlcat (path, "/d", sizeof path);
+      if (!mkdir (path))
+        fail ("mkdir \"%s\" failed", path);
+    }
+  strlcat (path, "/file", sizeof path);
+  CHECK (create (path, 0), "create file at the bottom");
+  CHECK ((fd = open (path)) > 1, "open file at the bottom");
+  close (fd);
+
+  CHECK (cachestat (&before), "cachestat");
+  msg ("open it %d more times", OPEN_CNT);
+  for (i = 0; i < OPEN_CNT; i++)
+    {
+      fd = open (path);
+      if (fd < 2)
+        fail ("open \"%s\" failed", path);
+      close (fd);
+    }
+  CHECK (cachestat (&after), "cachestat");
+
+  lookups = (after.hits + after.misses) - (before.hits + before.misses);
+  if (lookups >= OPEN_CNT * DEPTH)
+    fail ("%llu buffer cache lookups for %d opens of a path %d deep",
+          lookups, OPEN_CNT, DEPTH);
+  msg ("path resolved without reading the directories");
+}
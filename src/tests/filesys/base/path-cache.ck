@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(path-cache) begin
+(path-cache) creating a tree 16 directories deep...
+(path-cache) create file at the bottom
+(path-cache) open file at the bottom
+(path-cache) cachestat
+(path-cache) open it 10 more times
+(path-cache) cachestat
+(path-cache) path resolved without reading the directories
+(path-cache) end
+EOF
+pass;
@@ -0,0 +1,69 @@
+/* Makes a small "hot" file popular, then streams through a file
+   several times larger than the buffer cache and reads the hot
+   file again.  With a scan resistant replacement policy the hot
+   file, its inode and the directory holding it stay resident across
+   the scan: the cachestat system call must show next to no misses
+   for the last read of the hot file. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOT_SIZE (4 * 1024)
+#define WARM_SIZE (12 * 1024)
+#define SCAN_SIZE (128 * 1024)
+#define ROUNDS 2
+#define HOT_MISS_MAX 2                  /* Misses allowed re-reading "hot". */
+
+static char hot[HOT_SIZE];
+static char warm[WARM_SIZE];
+static char scan[SCAN_SIZE];
+
+static void
+make_file (const char *file_name, char *buf, size_t size, int seed) 
+{
+  int fd;
+
+  random_init (seed);
+  random_bytes (buf, size);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, size) == (int) size, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  struct cache_stats before, after;
+  unsigned long long misses;
+  int round;
+
+  make_file ("hot", hot, sizeof hot, 1);
+  make_file ("warm", warm, sizeof warm, 2);
+  make_file ("scan", scan, sizeof scan, 3);
+
+  for (round = 0; round < ROUNDS; round++) 
+    {
+      /* Re-reference the hot file after a short detour, so that
+         it counts as reused rather than as part of a stream. */
+      check_file ("hot", hot, sizeof hot);
+      check_file ("warm", warm, sizeof warm);
+      check_file ("hot", hot, sizeof hot);
+
+      /* Stream through the big file: this must not evict it. */
+      check_file ("scan", scan, sizeof scan);
+    }
+
+  CHECK (cachestat (&before), "cachestat");
+  check_file ("hot", hot, sizeof hot);
+  CHECK (cachestat (&after), "cachestat");
+
+  misses = after.misses - before.misses;
+  if (misses > HOT_MISS_MAX)
+    fail ("%llu misses re-reading \"hot\" after the scan", misses);
+  msg ("\"hot\" stayed in the cache across the scan");
+}
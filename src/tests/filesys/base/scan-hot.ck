@@ -0,0 +1,51 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(scan-hot) begin
+(scan-hot) create "hot"
+(scan-hot) open "hot"
+(scan-hot) write "hot"
+(scan-hot) close "hot"
+(scan-hot) create "warm"
+(scan-hot) open "warm"
+(scan-hot) write "warm"
+(scan-hot) close "warm"
+(scan-hot) create "scan"
+(scan-hot) open "scan"
+(scan-hot) write "scan"
+(scan-hot) close "scan"
+(scan-hot) open "hot" for verification
+(scan-hot) verified contents of "hot"
+(scan-hot) close "hot"
+(scan-hot) open "warm" for verification
+(scan-hot) verified contents of "warm"
+(scan-hot) close "warm"
+(scan-hot) open "hot" for verification
+(scan-hot) verified contents of "hot"
+(scan-hot) close "hot"
+(scan-hot) open "scan" for verification
+(scan-hot) verified contents of "scan"
+(scan-hot) close "scan"
+(scan-hot) open "hot" for verification
+(scan-hot) verified contents of "hot"
+(scan-hot) close "hot"
+(scan-hot) open "warm" for verification
+(scan-hot) verified contents of "warm"
+(scan-hot) close "warm"
+(scan-hot) open "hot" for verification
+(scan-hot) verified contents of "hot"
+(scan-hot) close "hot"
+(scan-hot) open "scan" for verification
+(scan-hot) verified contents of "scan"
+(scan-hot) close "scan"
+(scan-hot) cachestat
+(scan-hot) open "hot" for verification
+(scan-hot) verified contents of "hot"
+(scan-hot) close "hot"
+(scan-hot) cachestat
+(scan-hot) "hot" stayed in the cache across the scan
+(scan-hot) end
+EOF
+pass;
@@ -0,0 +1,51 @@
+/* Writes a byte 8 MB into an empty file, further than the file
+   system device is large, which only works if the gap is left
+   unallocated, and checks that the gap reads back as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FAR_OFS (8 * 1024 * 1024)
+
+static char buf[4096];
+
+static void
+check_zeros (int fd, unsigned ofs)
+{
+  size_t i;
+
+  memset (buf, 0xcc, sizeof buf);
+  seek (fd, ofs);
+  if (read (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read \"sparse\" at offset %u failed", ofs);
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %u of the hole is %d, not 0", ofs + i, buf[i]);
+}
+
+void
+test_main (void) 
+{
+  char byte = 'x';
+  int fd;
+
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+  msg ("seek \"sparse\"");
+  seek (fd, FAR_OFS);
+  CHECK (write (fd, &byte, 1) == 1, "write \"sparse\"");
+  CHECK (filesize (fd) == FAR_OFS + 1, "filesize \"sparse\"");
+
+  msg ("read the hole");
+  check_zeros (fd, 0);
+  check_zeros (fd, FAR_OFS / 2);
+  check_zeros (fd, FAR_OFS - sizeof buf);
+
+  seek (fd, FAR_OFS);
+  byte = 0;
+  CHECK (read (fd, &byte, 1) == 1 && byte == 'x', "read back the byte");
+  msg ("close \"sparse\"");
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse-far) begin
+(sparse-far) create "sparse"
+(sparse-far) open "sparse"
+(sparse-far) seek "sparse"
+(sparse-far) write "sparse"
+(sparse-far) filesize "sparse"
+(sparse-far) read the hole
+(sparse-far) read back the byte
+(sparse-far) close "sparse"
+(sparse-far) end
+EOF
+pass;
@@ -0,0 +1,72 @@
+/* Builds a tree of directories and writes their files a sector at a
+   time each in turn, as if by programs running together, then reads
+   the files back one after the other. The data is far larger than
+   the buffer cache, so the reads go to disk: the distance the disk
+   head travels for them, printed in the block statistics at
+   shutdown, measures how well the allocator keeps each file together
+   and near its directory. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DIR_CNT 4
+#define FILE_CNT 4                      /* Files per directory. */
+#define FILE_SIZE 8192
+#define CHUNK_SIZE 512
+
+static char buf[FILE_SIZE];
+static char data[FILE_SIZE];
+
+static void
+file_name (char *name, size_t size, int dir, int file)
+{
+  snprintf (name, size, "/d%d/f%d", dir, file);
+}
+
+void
+test_main (void)
+{
+  int fds[DIR_CNT][FILE_CNT];
+  char name[16];
+  size_t ofs;
+  int d, f;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+
+  for (d = 0; d < DIR_CNT; d++)
+    {
+      snprintf (name, sizeof name, "/d%d", d);
+      CHECK (mkdir (name), "mkdir \"%s\"", name);
+      for (f = 0; f < FILE_CNT; f++)
+        {
+          file_name (name, sizeof name, d, f);
+          if (!create (name, 0))
+            fail ("create \"%s\" failed", name);
+          fds[d][f] = open (name);
+          if (fds[d][f] < 2)
+            fail ("open \"%s\" failed", name);
+        }
+    }
+
+  msg ("write files in turn");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    for (d = 0; d < DIR_CNT; d++)
+      for (f = 0; f < FILE_CNT; f++)
+        if (write (fds[d][f], data + ofs, CHUNK_SIZE) != CHUNK_SIZE)
+          fail ("write at %zu failed", ofs);
+
+  msg ("read files back");
+  for (d = 0; d < DIR_CNT; d++)
+    for (f = 0; f < FILE_CNT; f++)
+      {
+        seek (fds[d][f], 0);
+        if (read (fds[d][f], buf, FILE_SIZE) != FILE_SIZE)
+          fail ("read of /d%d/f%d failed", d, f);
+        compare_bytes (buf, data, FILE_SIZE, 0, "file");
+        close (fds[d][f]);
+      }
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(tree-seek) begin
+(tree-seek) mkdir "/d0"
+(tree-seek) mkdir "/d1"
+(tree-seek) mkdir "/d2"
+(tree-seek) mkdir "/d3"
+(tree-seek) write files in turn
+(tree-seek) read files back
+(tree-seek) end
+EOF
+
+# Report the seek distance, so that kernels built with and without
+# ENABLE_ALLOCATION_GROUPS (see filesys/free-map.c) can be compared.
+our ($test);
+my ($seeked) = map (/\(filesys\): .* (\d+) sectors seeked/,
+		    read_text_file ("$test.output"));
+print STDOUT "tree-seek: $seeked sectors seeked\n" if defined $seeked;
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'g'}{"entry$_"} = [''] foreach 0...299;
+check_archive ($fs);
+pass;
@@ -0,0 +1,62 @@
+/* Creates enough files in a directory for its hash table to double
+   several times, with names that make entries wrap around from the
+   last buckets to the first ones while it does, and checks that every
+   name can still be found: each can be opened, none can be created a
+   second time, and readdir lists each once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+void
+test_main (void) 
+{
+  bool listed[FILE_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  int list_cnt = 0;
+  int fd;
+  int i;
+
+  CHECK (mkdir ("/g"), "mkdir \"/g\"");
+
+  msg ("creating /g/entry0 through /g/entry%d...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/g/entry%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("looking up each...");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/g/entry%d", i);
+      if (create (name, 0))
+        fail ("create \"%s\" succeeded a second time", name);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+
+  CHECK ((fd = open ("/g")) > 1, "open \"/g\"");
+  memset (listed, 0, sizeof listed);
+  while (readdir (fd, name))
+    {
+      if (memcmp (name, "entry", 5) || (i = atoi (name + 5)) < 0
+          || i >= FILE_CNT || listed[i])
+        fail ("readdir returned \"%s\"", name);
+      listed[i] = true;
+      list_cnt++;
+    }
+  if (list_cnt != FILE_CNT)
+    fail ("readdir listed %d files instead of %d", list_cnt, FILE_CNT);
+  msg ("readdir listed every file once");
+  msg ("close \"/g\"");
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed-grow) begin
+(dir-hashed-grow) mkdir "/g"
+(dir-hashed-grow) creating /g/entry0 through /g/entry299...
+(dir-hashed-grow) looking up each...
+(dir-hashed-grow) open "/g"
+(dir-hashed-grow) readdir listed every file once
+(dir-hashed-grow) close "/g"
+(dir-hashed-grow) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'h'}{"f$_"} = [''] foreach grep ($_ % 2 == 0, 0...99);
+check_archive ($fs);
+pass;
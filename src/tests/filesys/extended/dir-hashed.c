@@ -0,0 +1,69 @@
+/* Creates enough files in a directory for it to be kept as a hash
+   table, removes every other one, and checks that exactly the rest
+   can still be opened and are listed by readdir. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 100
+
+void
+test_main (void) 
+{
+  bool listed[FILE_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  int list_cnt = 0;
+  int fd;
+  int i;
+
+  CHECK (mkdir ("/h"), "mkdir \"/h\"");
+
+  msg ("creating /h/f0 through /h/f%d...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/h/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("removing the odd ones...");
+  for (i = 1; i < FILE_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "/h/f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+
+  msg ("opening each...");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/h/f%d", i);
+      fd = open (name);
+      if (i % 2 == 0 && fd < 2)
+        fail ("open \"%s\" failed", name);
+      if (i % 2 == 1 && fd != -1)
+        fail ("open \"%s\" returned %d after it was removed", name, fd);
+      if (fd > 1)
+        close (fd);
+    }
+
+  CHECK ((fd = open ("/h")) > 1, "open \"/h\"");
+  memset (listed, 0, sizeof listed);
+  while (readdir (fd, name))
+    {
+      if (name[0] != 'f' || (i = atoi (name + 1)) < 0 || i >= FILE_CNT
+          || i % 2 != 0 || listed[i])
+        fail ("readdir returned \"%s\"", name);
+      listed[i] = true;
+      list_cnt++;
+    }
+  if (list_cnt != FILE_CNT / 2)
+    fail ("readdir listed %d files instead of %d", list_cnt, FILE_CNT / 2);
+  msg ("readdir listed every remaining file once");
+  msg ("close \"/h\"");
+  close (fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed) begin
+(dir-hashed) mkdir "/h"
+(dir-hashed) creating /h/f0 through /h/f99...
+(dir-hashed) removing the odd ones...
+(dir-hashed) opening each...
+(dir-hashed) open "/h"
+(dir-hashed) readdir listed every remaining file once
+(dir-hashed) close "/h"
+(dir-hashed) end
+EOF
+pass;
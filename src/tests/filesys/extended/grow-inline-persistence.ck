@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($marker) = random_bytes (150);
+my ($config) = random_bytes (1000);
+check_archive ({"marker" => [$marker], "config" => [$config]});
+pass;
@@ -0,0 +1,21 @@
+/* Grows a file that stays small enough to be kept in its inode,
+   then one that outgrows it a few bytes at a time. */
+
+#include "tests/filesys/seq-test.h"
+#include "tests/main.h"
+
+static char small[150];
+static char large[1000];
+
+static size_t
+return_block_size (void) 
+{
+  return 37;
+}
+
+void
+test_main (void) 
+{
+  seq_test ("marker", small, sizeof small, 0, return_block_size, NULL);
+  seq_test ("config", large, sizeof large, 0, return_block_size, NULL);
+}
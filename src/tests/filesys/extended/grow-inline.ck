@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "marker"
+(grow-inline) open "marker"
+(grow-inline) writing "marker"
+(grow-inline) close "marker"
+(grow-inline) open "marker" for verification
+(grow-inline) verified contents of "marker"
+(grow-inline) close "marker"
+(grow-inline) create "config"
+(grow-inline) open "config"
+(grow-inline) writing "config"
+(grow-inline) close "config"
+(grow-inline) open "config" for verification
+(grow-inline) verified contents of "config"
+(grow-inline) close "config"
+(grow-inline) end
+EOF
+pass;
@@ -613,6 +613,19 @@ sub finish {
     exit 0;
 }
 
+# Returns a hash from the name of each numeric #define in C header
+# FILE_NAME to its value, so that a check script can use the same
+# constants as its test.
+sub read_c_defines {
+    my ($file_name) = @_;
+    my (%defines);
+    foreach (read_text_file ($file_name)) {
+	$defines{$1} = eval ($2)
+	  if /^#define\s+(\w+)\s+([\d\s()*+-]+?)\s*(\/\*.*)?$/;
+    }
+    return %defines;
+}
+
 sub read_text_file {
     my ($file_name) = @_;
     open (FILE, '<', $file_name) or die "$file_name: open: $!\n";
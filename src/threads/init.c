@@ -37,6 +37,7 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/inode.h"
 #endif
 #ifdef VM
 #include "vm/frame.h"
@@ -254,10 +255,23 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents (true);
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        bc_configure (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!bc_configure_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-dirty"))
+        bc_configure_writeback (atoi (value), -1);
+      else if (!strcmp (name, "-cache-age"))
+        bc_configure_writeback (-1, atoi (value));
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -382,8 +396,13 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -extents           With -f, store file data as extents.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Use SECTORS entries for the buffer cache.\n"
+          "  -cache-policy=POL  Use POL (clock or 2q) to evict cache entries.\n"
+          "  -cache-dirty=PCT   Write back once PCT%% of the cache is dirty.\n"
+          "  -cache-age=MS      Write back what has been dirty for MS ms.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
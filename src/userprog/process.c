@@ -322,13 +322,11 @@ load (struct args_struct *file_name_args, void (**eip) (void), void **esp)
   process_activate ();
 
   /* Open executable file. */
-  lock_fs ();
   file = filesys_open (file_name_args->file_name);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name_args->file_name);
       file_close (file);
-      unlock_fs ();
 
       goto done; 
     }
@@ -336,7 +334,6 @@ load (struct args_struct *file_name_args, void (**eip) (void), void **esp)
     {
       t->run_file = file;
       file_deny_write(file);
-      unlock_fs ();
     }
 
   /* Read and verify executable header. */
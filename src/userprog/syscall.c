@@ -5,6 +5,7 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "filesys/fsaccess.h"
+#include "filesys/cache.h"
 #include "userprog/process.h"
 #include "devices/shutdown.h"
 
@@ -29,6 +30,8 @@ static bool mkdir (const char *dir);
 static bool readdir (int fd, char *name);
 static bool isdir (int fd);
 static int inumber (int fd);
+static bool cachestat (struct cache_stats *stats, void *esp);
+static bool fallocate (int fd, unsigned size, bool keep_size);
 
 #define CHECK_PTR(esp, wants_to_write) \
 {\
@@ -72,7 +75,9 @@ syscall_handler (struct intr_frame *f)
   const void *buffer_cnst;
   const char *file, *dir;
   char *name;
+  struct cache_stats *stats;
   unsigned size, position, initial_size;
+  bool keep_size;
   switch (syscall_id)
   {
     case SYS_HALT:
@@ -183,6 +188,18 @@ syscall_handler (struct intr_frame *f)
 
       f->eax = inumber (fd);
     break;
+    case SYS_CACHESTAT:
+      stats = GET_PARAM(esp, struct cache_stats *);
+
+      f->eax = cachestat (stats, f->esp);
+    break;
+    case SYS_FALLOCATE:
+      fd = GET_PARAM(esp, int);
+      size = GET_PARAM(esp, unsigned);
+      keep_size = GET_PARAM(esp, int);
+
+      f->eax = fallocate (fd, size, keep_size);
+    break;
   }
 }
 
@@ -310,4 +327,20 @@ static bool isdir (int fd)
 static int inumber (int fd)
 {
   return fd_inode_number (fd);
-}
\ No newline at end of file
+}
+
+static bool cachestat (struct cache_stats *stats, void *esp)
+{
+  struct cache_stats copy;
+
+  CHECK_PTR_RANGE(stats, stats + 1, true, esp);
+
+  bc_get_stats (&copy);
+  *stats = copy;
+  return true;
+}
+
+static bool fallocate (int fd, unsigned size, bool keep_size)
+{
+  return allocate_open_file (fd, size, keep_size);
+}
@@ -0,0 +1,179 @@
+/* Host-side microbenchmark for bitmap_scan() in lib/kernel/bitmap.c.
+
+   Builds the kernel's bitmap code into a host program, checks its
+   scanner against the bit-at-a-time one it replaced on random
+   bitmaps, then times both on bitmaps of various fill ratios.
+
+   Usage: bitmap-bench [BITS] */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Provided by the kernel's lib/stdio.c, unused here. */
+void hex_dump (uintptr_t ofs, const void *buf, size_t size, bool ascii);
+
+#include "../lib/kernel/bitmap.c"
+
+void
+debug_panic (const char *file, int line, const char *function,
+             const char *message, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "PANIC at %s:%d in %s(): ", file, line, function);
+  va_start (args, message);
+  vfprintf (stderr, message, args);
+  va_end (args);
+  putc ('\n', stderr);
+  abort ();
+}
+
+void
+hex_dump (uintptr_t ofs, const void *buf, size_t size, bool ascii)
+{
+  (void) ofs;
+  (void) buf;
+  (void) size;
+  (void) ascii;
+}
+
+/* The scanner bitmap_scan() used to be: tries every start index. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= b->bit_cnt)
+    {
+      size_t last = b->bit_cnt - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!bitmap_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Sets each bit of B with probability FILL, in runs of random
+   length so that there are free runs of every size. */
+static void
+fill_random (struct bitmap *b, double fill)
+{
+  size_t i = 0;
+
+  bitmap_set_all (b, false);
+  while (i < bitmap_size (b))
+    {
+      size_t run = 1 + rand () % 16;
+      bool value = rand () < fill * RAND_MAX;
+
+      if (run > bitmap_size (b) - i)
+        run = bitmap_size (b) - i;
+      bitmap_set_multiple (b, i, run, value);
+      i += run;
+    }
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Checks bitmap_scan() against reference_scan() on random bitmaps,
+   and the summary against the bits. */
+static void
+check (void)
+{
+  int round;
+
+  for (round = 0; round < 2000; round++)
+    {
+      size_t bit_cnt = rand () % 700;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int i;
+
+      fill_random (b, (rand () % 101) / 100.0);
+      for (i = 0; i < 20; i++)
+        {
+          size_t start = bit_cnt > 0 ? rand () % (bit_cnt + 1) : 0;
+          size_t cnt = rand () % 80;
+          bool value = rand () % 2;
+          size_t got = bitmap_scan (b, start, cnt, value);
+          size_t want = reference_scan (b, start, cnt, value);
+
+          if (got != want)
+            {
+              fprintf (stderr, "bitmap_scan (%zu bits, %zu, %zu, %d) "
+                       "returned %zu, expected %zu\n",
+                       bit_cnt, start, cnt, value, got, want);
+              exit (EXIT_FAILURE);
+            }
+        }
+#ifdef ENABLE_BITMAP_SUMMARY
+      for (i = 0; (size_t) i < elem_cnt (bit_cnt); i++)
+        {
+          bool full = bitmap_all (b, i * ELEM_BITS,
+                                  bit_cnt - i * ELEM_BITS < ELEM_BITS
+                                  ? bit_cnt - i * ELEM_BITS : ELEM_BITS);
+          if (full != ((b->full[elem_idx (i)] & bit_mask (i)) != 0))
+            {
+              fprintf (stderr, "summary of element %d is wrong\n", i);
+              exit (EXIT_FAILURE);
+            }
+        }
+#endif
+      bitmap_destroy (b);
+    }
+  printf ("bitmap_scan agrees with the reference scanner\n");
+}
+
+/* Times ITERATIONS scans for CNT unset bits from random starting
+   points in B with SCAN, in microseconds per scan. */
+static double
+time_scan (size_t (*scan) (const struct bitmap *, size_t, size_t, bool),
+           const struct bitmap *b, size_t cnt, int iterations)
+{
+  volatile size_t sink = 0;
+  double begin = now ();
+  int i;
+
+  srand (1);
+  for (i = 0; i < iterations; i++)
+    sink += scan (b, rand () % bitmap_size (b), cnt, false);
+  return (now () - begin) * 1e6 / iterations;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const double fills[] = { 0.5, 0.9, 0.99, 1.0 };
+  static const size_t cnts[] = { 1, 8, 64 };
+  size_t bit_cnt = argc > 1 ? strtoul (argv[1], NULL, 10) : 1 << 18;
+  struct bitmap *b;
+  size_t f, c;
+
+  srand (0);
+  check ();
+
+  b = bitmap_create (bit_cnt);
+  if (b == NULL)
+    return EXIT_FAILURE;
+  printf ("%zu bits, microseconds per scan for unset bits:\n", bit_cnt);
+  printf ("%6s %5s %12s %12s\n", "fill", "cnt", "reference", "bitmap_scan");
+  for (f = 0; f < sizeof fills / sizeof *fills; f++)
+    {
+      fill_random (b, fills[f]);
+      for (c = 0; c < sizeof cnts / sizeof *cnts; c++)
+        printf ("%5.0f%% %5zu %12.2f %12.2f\n", fills[f] * 100, cnts[c],
+                time_scan (reference_scan, b, cnts[c], 20),
+                time_scan (bitmap_scan, b, cnts[c], 2000));
+    }
+  bitmap_destroy (b);
+  return EXIT_SUCCESS;
+}
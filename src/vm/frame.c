@@ -5,11 +5,41 @@
 #include "userprog/pagedir.h"
 #include "filesys/file.h"
 #include "filesys/fsaccess.h"
+#include "filesys/inode.h"
 
 static struct hash frame_hash;
 static struct lock frame_hash_lock;
 static struct lock frame_fs_lock;
 
+/* A read-only page of a file, shared by every process that maps the
+   same page of it. Shared frames are kept out of frame_hash, so they
+   are never evicted: a frame mapped by several page tables has no
+   single owner to page it out of. They are freed when the last
+   mapping goes away. */
+struct shared_frame
+{
+  struct inode *inode;                  /* File the page comes from. */
+  off_t offset;                         /* Offset of the page in it. */
+  uint32_t read_bytes;                  /* Bytes read, the rest is zero. */
+  void *page;                           /* Kernel address of the frame. */
+  int map_cnt;                          /* Page tables mapping it. */
+
+  struct hash_elem file_elem;           /* Element in shared_by_file. */
+  struct hash_elem page_elem;           /* Element in shared_by_page. */
+};
+
+static struct hash shared_by_file;
+static struct hash shared_by_page;
+static struct lock shared_lock;         /* Protects both tables. */
+
+static unsigned shared_file_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool shared_file_less (const struct hash_elem *e1,
+                              const struct hash_elem *e2, void *aux UNUSED);
+static unsigned shared_page_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool shared_page_less (const struct hash_elem *e1,
+                              const struct hash_elem *e2, void *aux UNUSED);
+static bool vm_frame_free_shared (void *page);
+
 unsigned find_frame (const struct hash_elem *e, void *aux UNUSED)
 {
   struct frame_entry *frame = hash_entry (e, struct frame_entry, elem);
@@ -28,6 +58,9 @@ void vm_frame_alloc_init ()
   hash_init (&frame_hash, find_frame, compare_frame, NULL);
   lock_init (&frame_hash_lock);
   lock_init (&frame_fs_lock);
+  hash_init (&shared_by_file, shared_file_hash, shared_file_less, NULL);
+  hash_init (&shared_by_page, shared_page_hash, shared_page_less, NULL);
+  lock_init (&shared_lock);
 }
 
 void *vm_frame_alloc (enum palloc_flags flags, void *thread_vaddr)
@@ -60,6 +93,9 @@ void vm_frame_free (void *page)
   struct hash_elem *e;
   struct frame_entry find;
 
+  if (vm_frame_free_shared (page))
+    return;
+
   find.page = page;
   /* Remove from list */
   lock_acquire (&frame_hash_lock);
@@ -72,6 +108,98 @@ void vm_frame_free (void *page)
   palloc_free_page (page);
 }
 
+/* Returns a frame holding the READ_BYTES bytes of FILE at OFFSET
+   followed by zeros, to be mapped read-only, and counts one more
+   mapping of it. The frame is shared with every other mapping of the
+   same page, so FILE must be denied writes for as long as it is
+   mapped, as executables are. Returns a null pointer if there is no
+   free frame or the file cannot be read; the page must then be
+   loaded into a private frame. Free it with vm_frame_free(). */
+void *vm_frame_get_shared (struct file *file, off_t offset,
+                           uint32_t read_bytes)
+{
+  struct shared_frame find, *sf;
+  struct hash_elem *e;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  find.inode = file_get_inode (file);
+  find.offset = offset;
+  find.read_bytes = read_bytes;
+
+  /* Held while reading, so that a page is only read once */
+  lock_acquire (&shared_lock);
+  e = hash_find (&shared_by_file, &find.file_elem);
+  if (e != NULL)
+    {
+      sf = hash_entry (e, struct shared_frame, file_elem);
+      sf->map_cnt++;
+      lock_release (&shared_lock);
+      return sf->page;
+    }
+
+  sf = malloc (sizeof *sf);
+  if (sf == NULL)
+    {
+      lock_release (&shared_lock);
+      return NULL;
+    }
+  sf->page = palloc_get_page (PAL_USER);
+  if (sf->page == NULL
+      || file_read_page (file, sf->page, read_bytes, offset)
+         != (off_t) read_bytes)
+    {
+      if (sf->page != NULL)
+        palloc_free_page (sf->page);
+      free (sf);
+      lock_release (&shared_lock);
+      return NULL;
+    }
+  memset ((uint8_t *) sf->page + read_bytes, 0, PGSIZE - read_bytes);
+
+  sf->inode = inode_reopen (find.inode);
+  sf->offset = offset;
+  sf->read_bytes = read_bytes;
+  sf->map_cnt = 1;
+  hash_insert (&shared_by_file, &sf->file_elem);
+  hash_insert (&shared_by_page, &sf->page_elem);
+  lock_release (&shared_lock);
+
+  return sf->page;
+}
+
+/* If PAGE is a shared frame, counts one mapping of it less, freeing
+   it after the last, and returns true. Returns false otherwise. */
+static bool vm_frame_free_shared (void *page)
+{
+  struct shared_frame find, *sf = NULL;
+  struct hash_elem *e;
+
+  find.page = page;
+  lock_acquire (&shared_lock);
+  e = hash_find (&shared_by_page, &find.page_elem);
+  if (e != NULL)
+    {
+      sf = hash_entry (e, struct shared_frame, page_elem);
+      if (--sf->map_cnt == 0)
+        {
+          hash_delete (&shared_by_page, &sf->page_elem);
+          hash_delete (&shared_by_file, &sf->file_elem);
+        }
+      else
+        sf = NULL;
+    }
+  lock_release (&shared_lock);
+
+  if (sf != NULL)
+    {
+      inode_close (sf->inode);
+      palloc_free_page (sf->page);
+      free (sf);
+    }
+  return e != NULL;
+}
+
 bool frame_hash_add (void *page, enum palloc_flags flags, void *thread_vaddr)
 {
   struct frame_entry *frame = malloc (sizeof(struct frame_entry));
@@ -185,4 +313,36 @@ bool page_out_evicted_frame (struct frame_entry *f)
     }
 
   return true;
-}
\ No newline at end of file
+}
+static unsigned shared_file_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  struct shared_frame *sf = hash_entry (e, struct shared_frame, file_elem);
+  return hash_bytes (&sf->inode, sizeof sf->inode) ^ hash_int (sf->offset);
+}
+
+static bool shared_file_less (const struct hash_elem *e1,
+                              const struct hash_elem *e2, void *aux UNUSED)
+{
+  struct shared_frame *a = hash_entry (e1, struct shared_frame, file_elem);
+  struct shared_frame *b = hash_entry (e2, struct shared_frame, file_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->read_bytes < b->read_bytes;
+}
+
+static unsigned shared_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  struct shared_frame *sf = hash_entry (e, struct shared_frame, page_elem);
+  return hash_bytes (&sf->page, sizeof sf->page);
+}
+
+static bool shared_page_less (const struct hash_elem *e1,
+                              const struct hash_elem *e2, void *aux UNUSED)
+{
+  struct shared_frame *a = hash_entry (e1, struct shared_frame, page_elem);
+  struct shared_frame *b = hash_entry (e2, struct shared_frame, page_elem);
+  return a->page < b->page;
+}
@@ -15,6 +15,9 @@
 #include "threads/vaddr.h"
 #include "lib/kernel/hash.h"
 #include "threads/thread.h"
+#include "filesys/off_t.h"
+
+struct file;
 
 struct frame_entry
 {
@@ -31,6 +34,8 @@ void frame_install_page (void *upage, void *kpage);
 void vm_frame_alloc_init (void);
 void *vm_frame_alloc (enum palloc_flags flags, void *thread_vaddr);
 void vm_frame_free (void *page);
+void *vm_frame_get_shared (struct file *file, off_t offset,
+                           uint32_t read_bytes);
 bool frame_hash_add (void *page, enum palloc_flags flags, void *thread_vaddr);
 void frame_hash_remove (struct list_elem *e);
 bool page_out_evicted_frame (struct frame_entry *f);
@@ -14,6 +14,7 @@ int last_map_id = 0;
 static struct pt_suppl_entry *
 pt_suppl_setup_file_info (struct file *file, off_t offset, uint8_t *page_addr, 
 uint32_t read_bytes, uint32_t zero_bytes, bool writable, enum pt_status status);
+static bool pt_suppl_page_in_shared (struct pt_suppl_entry *entry);
 
 void pt_suppl_init (struct hash *table)
 {
@@ -43,9 +44,7 @@ int
 pt_suppl_handle_mmap (struct file *f, void *start_page)
 {
   struct thread *curr = thread_current ();
-  lock_fs ();
   off_t length = file_length (f);
-  unlock_fs ();
   int remaining;
   bool error = false;
   if (length == 0)
@@ -145,11 +144,7 @@ pt_suppl_handle_unmap (int map_id)
       }
     }
   if(file_to_close)
-  {
-    lock_fs ();
     file_close (file_to_close);
-    unlock_fs ();
-  }
 }
 
 struct pt_suppl_entry * 
@@ -253,8 +248,41 @@ pt_suppl_setup_file_info (struct file *file, off_t offset, uint8_t *page_addr,
   return entry;
 }
 
+/* Maps ENTRY, a read-only page of an executable, to the frame
+   shared by every process running it. The executable is denied
+   writes while it runs, so the shared copy cannot go stale. Returns
+   false if there is no shared frame for it, and the page must be
+   loaded into a frame of its own. */
+static bool
+pt_suppl_page_in_shared (struct pt_suppl_entry *entry)
+{
+  struct pt_suppl_file_info *info = entry->file_info;
+  void *frame;
+
+  if (!IS_LAZY (entry->status) || !IS_UNLOADED (entry->status)
+      || info->writable || info->read_bytes == 0)
+    return false;
+
+  frame = vm_frame_get_shared (info->file, info->offset, info->read_bytes);
+  if (frame == NULL)
+    return false;
+  if (!pagedir_set_page (thread_current ()->pagedir, entry->vaddr, frame,
+                         false))
+    {
+      vm_frame_free (frame);
+      return false;
+    }
+
+  hash_delete (&thread_current ()->pt_suppl, &entry->elem);
+  pt_suppl_destroy (entry);
+  return true;
+}
+
 bool pt_suppl_page_in (struct pt_suppl_entry *entry)
 {
+  if (pt_suppl_page_in_shared (entry))
+    return true;
+
   uint8_t *frame = vm_frame_alloc (PAL_USER, entry->vaddr);
   if (frame == NULL) return false;
 
@@ -287,10 +315,9 @@ bool pt_suppl_page_in (struct pt_suppl_entry *entry)
       ASSERT (info != NULL);
 
       bool read = false, pagedir = false;
-      file_seek (info->file, info->offset);
       if(info->read_bytes > 0)
       {
-        read = file_read (info->file, frame, info->read_bytes);
+        read = file_read_page (info->file, frame, info->read_bytes, info->offset);
         memset (frame + info->read_bytes, 0, info->zero_bytes);
       }
       else
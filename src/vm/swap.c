@@ -1,7 +1,6 @@
 #include "devices/block.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
-#include "filesys/fsaccess.h"
 #include "swap.h"
 #include <bitmap.h>
 #include <stdbool.h>
@@ -36,9 +35,7 @@ swap_in (size_t slot, void* page)
     {
       block_sector_t from = swap_addr_base + i;
       void* to = page + i * BLOCK_SECTOR_SIZE;
-      lock_fs ();
       block_read (swap_device, from, to);
-      unlock_fs ();
     }
 
   swap_free (slot);
@@ -54,14 +51,12 @@ swap_out (const void* page)
   if (slot != BITMAP_ERROR)
     {
       size_t swap_addr_base = slot * SECTORS_PER_PAGE;
-      lock_fs ();
       for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
         {
           const void* from = page + i * BLOCK_SECTOR_SIZE;
           block_sector_t to = swap_addr_base + i;
           block_write (swap_device, to, from);
         }
-      unlock_fs ();
       lock_release (&swap_lock);
       return slot;  
     }